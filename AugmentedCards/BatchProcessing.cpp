@@ -0,0 +1,355 @@
+#include "BatchProcessing.h"
+#include "BoundedQueue.h"
+#include "CardDetection.h"
+#include "SimpleGame.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <set>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+/* An image moving through the pipeline, along with everything reported about it. Timings are in milliseconds. */
+struct BatchItem
+{
+	string filename;
+	string outputName;
+	string status;
+	Mat image;
+	vector<Card> move;
+	vector<int> winners;
+	double decodeTime, contoursTime, detectTime, evaluateTime, drawTime, encodeTime;
+};
+
+static double getElapsedTime(int64 start)
+{
+	return (getTickCount() - start) * 1000.0 / getTickFrequency();
+}
+
+static string getBaseName(const string &filename)
+{
+	size_t separator = filename.find_last_of("/\\");
+	return separator == string::npos ? filename : filename.substr(separator + 1);
+}
+
+// Annotated images never take the name of an input: name.annotated.ext, numbered when inputs from different folders share a name
+static vector<string> getOutputNames(const vector<string> &images)
+{
+	vector<string> names;
+	set<string> used;
+
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		string baseName = getBaseName(images[i]);
+		size_t dot = baseName.find_last_of('.');
+		string stem = dot == string::npos ? baseName : baseName.substr(0, dot);
+		string extension = dot == string::npos ? ".png" : baseName.substr(dot);
+		string name = stem + ".annotated" + extension;
+
+		for (int copy = 2; used.count(name) > 0; copy++)
+		{
+			name = stem + "." + to_string(copy) + ".annotated" + extension;
+		}
+
+		used.insert(name);
+		names.push_back(name);
+	}
+
+	return names;
+}
+
+// Matches the names given by getOutputNames, so a rerun over an output folder inside the input does not take its own results as inputs
+static bool isAnnotatedImage(const string &filename)
+{
+	const string suffix = ".annotated";
+	string baseName = getBaseName(filename);
+	size_t dot = baseName.find_last_of('.');
+
+	return dot != string::npos && dot >= suffix.size() && baseName.compare(dot - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool isImageFile(const string &filename)
+{
+	const string extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff" };
+	size_t dot = filename.find_last_of('.');
+
+	if (dot == string::npos)
+	{
+		return false;
+	}
+
+	string extension = filename.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	return find(begin(extensions), end(extensions), extension) != end(extensions);
+}
+
+static void createFolder(const string &path)
+{
+	// Fails harmlessly if the folder already exists, any other problem shows up when writing to it
+#ifdef _WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+}
+
+static string escapeJson(const string &text)
+{
+	string escaped;
+
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		if (text[i] == '"' || text[i] == '\\')
+		{
+			escaped += '\\';
+		}
+
+		escaped += text[i];
+	}
+
+	return escaped;
+}
+
+static string escapeCsv(const string &text)
+{
+	string escaped = "\"";
+
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		escaped += text[i];
+
+		if (text[i] == '"')
+		{
+			escaped += '"';
+		}
+	}
+
+	return escaped + "\"";
+}
+
+static string formatReportHeader(BatchFormat format)
+{
+	if (format == Csv)
+	{
+		return "file,status,cards,winners,decode_ms,contours_ms,detect_ms,evaluate_ms,draw_ms,encode_ms";
+	}
+
+	return "";
+}
+
+static string formatReportLine(const BatchItem &item, BatchFormat format)
+{
+	stringstream line;
+	line << fixed << setprecision(3);
+
+	if (format == Json)
+	{
+		line << "{\"file\":\"" << escapeJson(item.filename) << "\",\"status\":\"" << item.status << "\",\"cards\":[";
+
+		for (size_t i = 0; i < item.move.size(); i++)
+		{
+			line << (i > 0 ? "," : "") << "{\"symbol\":\"" << escapeJson(item.move[i].symbol) << "\",\"suit\":\"" << escapeJson(item.move[i].suit) << "\"}";
+		}
+
+		line << "],\"winners\":[";
+
+		for (size_t i = 0; i < item.winners.size(); i++)
+		{
+			line << (i > 0 ? "," : "") << item.winners[i];
+		}
+
+		line << "],\"timings\":{\"decode\":" << item.decodeTime << ",\"contours\":" << item.contoursTime << ",\"detect\":" << item.detectTime
+			<< ",\"evaluate\":" << item.evaluateTime << ",\"draw\":" << item.drawTime << ",\"encode\":" << item.encodeTime << "}}";
+	}
+	else
+	{
+		string cards, winners;
+
+		// Multiple values share a column, separated by semicolons
+		for (size_t i = 0; i < item.move.size(); i++)
+		{
+			cards += (i > 0 ? ";" : "") + item.move[i].symbol + " " + item.move[i].suit;
+		}
+
+		for (size_t i = 0; i < item.winners.size(); i++)
+		{
+			winners += (i > 0 ? ";" : "") + to_string(item.winners[i]);
+		}
+
+		line << escapeCsv(item.filename) << "," << item.status << "," << escapeCsv(cards) << "," << escapeCsv(winners) << ","
+			<< item.decodeTime << "," << item.contoursTime << "," << item.detectTime << ","
+			<< item.evaluateTime << "," << item.drawTime << "," << item.encodeTime;
+	}
+
+	return line.str();
+}
+
+vector<string> listBatchImages(const string &input)
+{
+	vector<string> filenames, images;
+
+	// A folder lists every file in it, anything else is treated as a pattern
+	glob(input, filenames, false);
+
+	for (size_t i = 0; i < filenames.size(); i++)
+	{
+		if (isImageFile(filenames[i]) && !isAnnotatedImage(filenames[i]))
+		{
+			images.push_back(filenames[i]);
+		}
+	}
+
+	sort(images.begin(), images.end());
+	return images;
+}
+
+int runBatch(const vector<string> &images, const string &output, BatchFormat format, const vector<Card> &deck, const DeckIndex &index,
+	DetectionMethod method, bool allCards)
+{
+	BoundedQueue<BatchItem> decoded(BATCH_QUEUE_SIZE);
+	BoundedQueue<BatchItem> detected(BATCH_QUEUE_SIZE);
+	int games = 0;
+
+	createFolder(output);
+
+	vector<string> outputNames = getOutputNames(images);
+
+	string reportName = output + "/" + (format == Json ? "report.jsonl" : "report.csv");
+	ofstream report(reportName);
+
+	if (!report.is_open())
+	{
+		cout << "Could not create the report: " << reportName << endl;
+		return 0;
+	}
+
+	string header = formatReportHeader(format);
+
+	if (!header.empty())
+	{
+		report << header << endl;
+	}
+
+	// Decoding stage, images are resized as in the interactive mode so the results match
+	thread decoder([&]()
+	{
+		for (size_t i = 0; i < images.size(); i++)
+		{
+			BatchItem item;
+			item.filename = images[i];
+			item.outputName = outputNames[i];
+			item.contoursTime = item.detectTime = item.evaluateTime = item.drawTime = item.encodeTime = 0;
+
+			int64 start = getTickCount();
+			item.image = imread(images[i], IMREAD_COLOR);
+
+			if (!item.image.empty())
+			{
+				item.image = resizeWithLimits(item.image, 1000, 700);
+			}
+
+			item.decodeTime = getElapsedTime(start);
+
+			if (!decoded.push(std::move(item)))
+			{
+				break;
+			}
+		}
+
+		decoded.close();
+	});
+
+	// Encoding stage, the report is written in input order since each stage handles one image at a time
+	thread encoder([&]()
+	{
+		BatchItem item;
+
+		while (detected.pop(item))
+		{
+			if (item.status == "ok")
+			{
+				int64 start = getTickCount();
+
+				if (!imwrite(output + "/" + item.outputName, item.image))
+				{
+					item.status = "unwritable";
+				}
+
+				item.encodeTime = getElapsedTime(start);
+			}
+
+			report << formatReportLine(item, format) << endl;
+		}
+	});
+
+	// Detection stage runs on the calling thread, spreading the cards of each image across the thread pool
+	BatchItem item;
+
+	while (decoded.pop(item))
+	{
+		int64 start;
+
+		if (item.image.empty())
+		{
+			item.status = "unreadable";
+		}
+		else
+		{
+			start = getTickCount();
+
+			if (allCards)
+			{
+				item.move = findCardCandidates(item.image);
+			}
+			else
+			{
+				vector<vector<Point>> contours = getContours(item.image);
+				item.move = locateCards(item.image, contours, GAME_CARDS);
+			}
+
+			item.contoursTime = getElapsedTime(start);
+
+			if ((int)item.move.size() < (allCards ? 1 : GAME_CARDS))
+			{
+				item.status = "not enough cards";
+				item.move.clear();
+			}
+			else
+			{
+				start = getTickCount();
+				identifyCards(item.image, item.move, deck, index, method);
+				item.detectTime = getElapsedTime(start);
+
+				start = getTickCount();
+				SimpleGame game;
+				item.winners = game.evaluateGame(item.move);
+				item.evaluateTime = getElapsedTime(start);
+
+				start = getTickCount();
+				drawCards(item.image, item.move, item.winners);
+				item.drawTime = getElapsedTime(start);
+
+				item.status = "ok";
+				games++;
+			}
+		}
+
+		cout << getBaseName(item.filename) << ": " << item.status << endl;
+		detected.push(std::move(item));
+	}
+
+	detected.close();
+	decoder.join();
+	encoder.join();
+
+	cout << endl << games << " of " << images.size() << " images with a game, report written to " << reportName << endl;
+	return games;
+}
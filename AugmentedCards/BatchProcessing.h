@@ -0,0 +1,37 @@
+#pragma once
+
+#include "OpenCV.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include "Card.h"
+#include "DeckIndex.h"
+#include "DetectionMethod.h"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Non-interactive processing of a set of images, for offline (batch) jobs.
+ * Decoding, detection and encoding run as a pipeline of three stages connected by bounded queues.
+ */
+
+const int BATCH_QUEUE_SIZE = 4;
+
+/* Format of the batch report, one line per image. */
+enum BatchFormat
+{
+	Json,
+	Csv
+};
+
+/* Returns the images in a folder, or matched by a wildcard pattern (e.g. every png in a folder), ordered by name.
+ * Annotated images written by runBatch (name.annotated.ext) are left out. */
+vector<string> listBatchImages(const string &input);
+
+/* Detects the cards of a game in each image (every card if allCards is set), writing annotated images (name.annotated.ext) and a report
+ * (report.jsonl / report.csv) to an output folder. Returns the number of images with a game. */
+int runBatch(const vector<string> &images, const string &output, BatchFormat format, const vector<Card> &deck, const DeckIndex &index,
+	DetectionMethod method, bool allCards = false);
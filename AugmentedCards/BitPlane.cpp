@@ -0,0 +1,263 @@
+#include "BitPlane.h"
+#include "Workspace.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+static inline int popcount64(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(word);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	return (int)__popcnt64(word);
+#else
+	word = word - ((word >> 1) & 0x5555555555555555ULL);
+	word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+	word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((word * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+#if defined(__AVX2__)
+// Nibble lookup popcount, leaves four 64-bit partial sums in the result
+static inline __m256i popcount256(__m256i v)
+{
+	const __m256i lookup = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i lowMask = _mm256_set1_epi8(0x0f);
+
+	__m256i low = _mm256_and_si256(v, lowMask);
+	__m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+	__m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+
+	return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+static inline int sum256(__m256i v)
+{
+	return (int)(_mm256_extract_epi64(v, 0) + _mm256_extract_epi64(v, 1) + _mm256_extract_epi64(v, 2) + _mm256_extract_epi64(v, 3));
+}
+#endif
+
+BitPlane packBitPlane(const Mat &binary)
+{
+	BitPlane plane;
+	plane.rows = binary.rows;
+	plane.cols = binary.cols;
+	plane.stride = (binary.cols + 63) / 64;
+
+	uint64_t *words = new uint64_t[plane.rows * plane.stride]();
+	plane.words = shared_ptr<const uint64_t>(words, default_delete<uint64_t[]>());
+
+	// Bit j of word w holds the pixel at column (64 * w + j)
+	for (int i = 0; i < binary.rows; i++)
+	{
+		const uchar *pixels = binary.ptr<uchar>(i);
+		uint64_t *row = &words[i * plane.stride];
+
+		for (int j = 0; j < binary.cols; j++)
+		{
+			if (pixels[j] != 0)
+			{
+				row[j >> 6] |= 1ULL << (j & 63);
+			}
+		}
+	}
+
+	return plane;
+}
+
+vector<BitPlane> buildBitPyramid(const Mat &binary)
+{
+	vector<BitPlane> pyramid;
+
+	for (int level = 0; level < BIT_PYRAMID_LEVELS; level++)
+	{
+		int size = BIT_PYRAMID_SIZES[level];
+
+		if (binary.cols == size && binary.rows == size)
+		{
+			pyramid.push_back(packBitPlane(binary));
+		}
+		else
+		{
+			Mat resized = getWorkspace().getBuffer("buildBitPyramid/resized", Size(size, size), CV_8UC1, level);
+			resize(binary, resized, Size(size, size), 0, 0, INTER_AREA);
+			threshold(resized, resized, 63, 255, THRESH_BINARY);
+			pyramid.push_back(packBitPlane(resized));
+		}
+	}
+
+	return pyramid;
+}
+
+int popcount(const uint64_t *words, size_t count)
+{
+	size_t i = 0;
+	int total = 0;
+
+#if defined(__AVX2__)
+	__m256i sums = _mm256_setzero_si256();
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(words + i));
+		sums = _mm256_add_epi64(sums, popcount256(v));
+	}
+
+	total += sum256(sums);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint64x2_t sums = vdupq_n_u64(0);
+
+	for (; i + 2 <= count; i += 2)
+	{
+		uint8x16_t v = vreinterpretq_u8_u64(vld1q_u64(words + i));
+		sums = vpadalq_u32(sums, vpaddlq_u16(vpaddlq_u8(vcntq_u8(v))));
+	}
+
+	total += (int)(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+#endif
+
+	for (; i < count; i++)
+	{
+		total += popcount64(words[i]);
+	}
+
+	return total;
+}
+
+int popcountXor(const uint64_t *words1, const uint64_t *words2, size_t count)
+{
+	size_t i = 0;
+	int total = 0;
+
+#if defined(__AVX2__)
+	__m256i sums = _mm256_setzero_si256();
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(words1 + i));
+		__m256i v2 = _mm256_loadu_si256((const __m256i *)(words2 + i));
+		sums = _mm256_add_epi64(sums, popcount256(_mm256_xor_si256(v1, v2)));
+	}
+
+	total += sum256(sums);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint64x2_t sums = vdupq_n_u64(0);
+
+	for (; i + 2 <= count; i += 2)
+	{
+		uint8x16_t v = vreinterpretq_u8_u64(veorq_u64(vld1q_u64(words1 + i), vld1q_u64(words2 + i)));
+		sums = vpadalq_u32(sums, vpaddlq_u16(vpaddlq_u8(vcntq_u8(v))));
+	}
+
+	total += (int)(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+#endif
+
+	for (; i < count; i++)
+	{
+		total += popcount64(words1[i] ^ words2[i]);
+	}
+
+	return total;
+}
+
+int getBitPlaneDiff(const BitPlane &plane1, const BitPlane &plane2, int tolerance, int bound)
+{
+	int rows = plane1.rows;
+	int stride = plane1.stride;
+	size_t count = (size_t)rows * stride;
+	const uint64_t *words1 = plane1.words.get();
+	const uint64_t *words2 = plane2.words.get();
+	int total = 0;
+
+	// Rows are counted in bands, so a comparison stops as soon as it is known to exceed the bound
+	if (tolerance <= 0)
+	{
+		for (int i = 0; i < rows && total <= bound; i += BIT_DIFF_BAND_ROWS)
+		{
+			int band = min(BIT_DIFF_BAND_ROWS, rows - i);
+			total += popcountXor(&words1[i * stride], &words2[i * stride], (size_t)band * stride);
+		}
+
+		return total;
+	}
+
+	if (rows <= 2 * tolerance)
+	{
+		return 0;
+	}
+
+	// Scratch buffers are reused between calls to avoid allocating for every deck card
+	static thread_local vector<uint64_t> diff, eroded;
+	diff.resize(count);
+	eroded.resize(count);
+
+	int erodedRows = 0;
+
+	for (int start = tolerance; start < rows - tolerance && total <= bound; start += BIT_DIFF_BAND_ROWS)
+	{
+		int end = min(start + BIT_DIFF_BAND_ROWS, rows - tolerance);
+
+		// Horizontal pass, only as far as this band needs: a differing pixel survives only if its neighbours within the tolerance also differ
+		for (; erodedRows < end + tolerance; erodedRows++)
+		{
+			int i = erodedRows;
+			const uint64_t *row1 = &words1[i * stride];
+			const uint64_t *row2 = &words2[i * stride];
+			uint64_t *diffRow = &diff[i * stride];
+			uint64_t *erodedRow = &eroded[i * stride];
+
+			for (int w = 0; w < stride; w++)
+			{
+				diffRow[w] = row1[w] ^ row2[w];
+			}
+
+			for (int w = 0; w < stride; w++)
+			{
+				uint64_t current = diffRow[w];
+				uint64_t previous = w > 0 ? diffRow[w - 1] : 0;
+				uint64_t next = w < stride - 1 ? diffRow[w + 1] : 0;
+				uint64_t bits = current;
+
+				for (int t = 1; t <= tolerance; t++)
+				{
+					bits &= (current << t) | (previous >> (64 - t));
+					bits &= (current >> t) | (next << (64 - t));
+				}
+
+				erodedRow[w] = bits;
+			}
+		}
+
+		// Vertical pass over the horizontally eroded rows of the band, border rows are discarded
+		for (int i = start; i < end; i++)
+		{
+			uint64_t *diffRow = &diff[i * stride];
+
+			for (int w = 0; w < stride; w++)
+			{
+				uint64_t bits = eroded[i * stride + w];
+
+				for (int t = 1; t <= tolerance; t++)
+				{
+					bits &= eroded[(i - t) * stride + w] & eroded[(i + t) * stride + w];
+				}
+
+				diffRow[w] = bits;
+			}
+		}
+
+		total += popcount(&diff[start * stride], (size_t)(end - start) * stride);
+	}
+
+	return total;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "OpenCV.h"
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <climits>
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Bit-packed binary image used by the binary method: one bit per pixel, each row padded to a stride of 64-bit words.
+ * The words are either owned by the bitplane or shared with a memory-mapped deck cache (see DeckCache.h).
+ */
+struct BitPlane
+{
+	int rows, cols, stride;
+	shared_ptr<const uint64_t> words;
+};
+
+/* Side of each (square) level in a bitplane pyramid, from coarsest to finest. */
+const int BIT_PYRAMID_SIZES[] = { 56, 112, 450 };
+const int BIT_PYRAMID_LEVELS = 3;
+
+/* Packs a binary image into a bitplane. Any non-zero pixel is treated as set. */
+BitPlane packBitPlane(const Mat &binary);
+
+/* Packs a binary image into a pyramid of bitplanes, one per level in BIT_PYRAMID_SIZES.
+ * Coarser levels are area-downsampled, and a pixel is set when at least a quarter of its block is set (keeps thin outlines). */
+vector<BitPlane> buildBitPyramid(const Mat &binary);
+
+/* Rows compared at a time by getBitPlaneDiff before checking its bound. */
+const int BIT_DIFF_BAND_ROWS = 64;
+
+/* Returns the number of differences in pixels between two bitplanes of the same size, ignoring those not filling a (2 * tolerance + 1) square.
+ * Once the total exceeds bound (checked every BIT_DIFF_BAND_ROWS rows), a partial total above bound is returned. */
+int getBitPlaneDiff(const BitPlane &plane1, const BitPlane &plane2, int tolerance, int bound = INT_MAX);
+
+/* Returns the number of set bits in a sequence of words. Uses AVX2 or NEON when available. */
+int popcount(const uint64_t *words, size_t count);
+
+/* Returns the number of set bits in the XOR of two sequences of words. Uses AVX2 or NEON when available. */
+int popcountXor(const uint64_t *words1, const uint64_t *words2, size_t count);
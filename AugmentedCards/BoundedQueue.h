@@ -0,0 +1,77 @@
+#pragma once
+
+#include <iostream>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+/*
+ * Fixed capacity queue between the stages of a pipeline: producers block while it is full, consumers while it is empty.
+ * Once closed, pushes fail, and pops fail as soon as the remaining items are consumed.
+ */
+template <typename T>
+class BoundedQueue
+{
+private:
+	deque<T> items;
+	size_t capacity;
+	bool closed;
+	mutex lock;
+	condition_variable notFull, notEmpty;
+
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false)
+	{
+	}
+
+	/* Adds an item, waiting for space if needed. Returns false (dropping the item) if the queue was closed. */
+	bool push(T item)
+	{
+		unique_lock<mutex> guard(lock);
+		notFull.wait(guard, [this] { return closed || items.size() < capacity; });
+
+		if (closed)
+		{
+			return false;
+		}
+
+		items.push_back(std::move(item));
+		guard.unlock();
+		notEmpty.notify_one();
+
+		return true;
+	}
+
+	/* Removes the oldest item, waiting for one if needed. Returns false if the queue was closed and is empty. */
+	bool pop(T &item)
+	{
+		unique_lock<mutex> guard(lock);
+		notEmpty.wait(guard, [this] { return closed || !items.empty(); });
+
+		if (items.empty())
+		{
+			return false;
+		}
+
+		item = std::move(items.front());
+		items.pop_front();
+		guard.unlock();
+		notFull.notify_one();
+
+		return true;
+	}
+
+	/* Marks the end of the input. Items already queued can still be popped. */
+	void close()
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			closed = true;
+		}
+
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+};
@@ -1,16 +1,12 @@
 #pragma once
 
-#include <opencv\cv.h>
-#include <opencv2\core\core_c.h>
-#include <opencv2\highgui\highgui.hpp>
-#include <opencv2\imgproc\imgproc.hpp>
-#include <opencv2\features2d\features2d.hpp>
-#include <opencv2\nonfree\nonfree.hpp>
-#include <opencv2\nonfree\features2d.hpp>
+#include "OpenCV.h"
 
 #include <iostream>
 #include <vector>
+#include <memory>
 
+#include "BitPlane.h"
 #include "Rectangle.h"
 
 using namespace std;
@@ -31,4 +27,8 @@ struct Card
 
 	Mat image, descriptors;
 	vector<KeyPoint> keyPoints;
+	vector<BitPlane> pyramid;
+
+	// Keeps a memory-mapped deck cache alive while the image or descriptors point into it
+	shared_ptr<void> storage;
 };
\ No newline at end of file
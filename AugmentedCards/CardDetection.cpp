@@ -1,6 +1,21 @@
 #include "CardDetection.h"
-
-void train(string filename, int nCards, DetectionMethod method)
+#include "DeckCache.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "Workspace.h"
+
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+void train(const string &filename, int nCards, DetectionMethod method)
 {
 	Mat deck = imread(filename, IMREAD_COLOR);
 
@@ -12,7 +27,7 @@ void train(string filename, int nCards, DetectionMethod method)
 
 	// Get contours for all cards
 	Mat cardBase = Mat::zeros(Size(450 * nCards, 450), CV_8UC3);
-	vector<vector<Point>> contours = getContours(deck);
+	vector<vector<Point>> contours = getContours(deck, nCards);
 
 	if ((int)contours.size() < nCards)
 	{
@@ -33,20 +48,33 @@ void train(string filename, int nCards, DetectionMethod method)
 	imwrite("../Assets/deck_training.png", cardBase);
 }
 
-vector<Card> readDeckList(string path)
+vector<Card> readDeckList(const string &path)
+{
+	vector<Card> deck;
+
+	if (!loadDeckList(path, deck))
+	{
+		cout << "Could not open or find the file." << endl;
+		exit(-1);
+	}
+
+	return deck;
+}
+
+bool loadDeckList(const string &path, vector<Card> &deck)
 {
 	ifstream file(path + "deck.txt");
 	stringstream stream;
 	string line, word;
-	vector<Card> deck;
 	Card card;
 
 	if (!file.is_open())
 	{
-		cout << "Could not open or find the file." << endl;
-		exit(-1);
+		return false;
 	}
 
+	deck.clear();
+
 	// Each line should contain a single card
 	while (getline(file, line))
 	{
@@ -73,34 +101,57 @@ vector<Card> readDeckList(string path)
 	}
 
 	file.close();
-	return deck;
+	return true;
+}
+
+string getDeckImageName(DetectionMethod method)
+{
+	return isFeatureMethod(method) ? "deck_surf.png" : "deck_binary.png";
+}
+
+void readDeckImage(const string &path, vector<Card> &deck, DetectionMethod method)
+{
+	if (!isMethodAvailable(method))
+	{
+		cout << "The SURF method requires the xfeatures2d module of OpenCV (opencv_contrib)." << endl;
+		exit(-1);
+	}
+
+	if (!loadDeckImage(path, deck, method))
+	{
+		cout << "Could not open or find the file." << endl;
+		exit(-1);
+	}
 }
 
-void readDeckImage(string path, vector<Card> &deck, DetectionMethod method)
+bool loadDeckImage(const string &path, vector<Card> &deck, DetectionMethod method)
 {
 	Mat deckImage;
 
-	// The binary deck is stored after a pre-processing phase, in black and white
-	if (method == Binary)
+	// A valid index already holds every pre-processed card, so the deck image is not even decoded
+	if (loadDeckCache(path, deck, method))
 	{
-		deckImage = imread(path + "deck_binary.png", IMREAD_GRAYSCALE);
+		return true;
 	}
 
-	// The SURF deck is an image containing all the cards, with no previous processing
-	else if (method == Surf)
+	// The binary deck is stored after a pre-processing phase, in black and white. The corner method reads its signatures from it
+	if (method == Binary || method == Corner)
 	{
-		deckImage = imread(path + "deck_surf.png", IMREAD_COLOR);
-		cout << endl << "Pre-processing the deck..." << endl;
+		deckImage = imread(path + getDeckImageName(method), IMREAD_GRAYSCALE);
 	}
 
-	if (deckImage.empty())
+	// The SURF deck is an image containing all the cards, with no previous processing. ORB shares it
+	else if (isFeatureMethod(method))
 	{
-		cout << "Could not open or find the file." << endl;
-		exit(-1);
+		deckImage = imread(path + getDeckImageName(method), IMREAD_COLOR);
+		cout << endl << "Pre-processing the deck..." << endl;
 	}
 
-	SurfFeatureDetector detector(SURF_HESSIAN);
-	SurfDescriptorExtractor extractor;
+	// Every card of the list has to be in the image
+	if (deckImage.empty() || deckImage.cols < (int)deck.size() * 450 || deckImage.rows < 450)
+	{
+		return false;
+	}
 
 	// Append each card, as an image, to the existing deck
 	for (size_t i = 0; i < deck.size(); i++)
@@ -108,22 +159,29 @@ void readDeckImage(string path, vector<Card> &deck, DetectionMethod method)
 		Mat card = deckImage(Rect(i * 450, 0, 450, 450));
 		deck[i].image = card;
 
-		// If using the SURF method, keypoints and descriptors should only be processed once and stored for later use
-		if (method == Surf)
+		// If using the binary method, each card is packed into a pyramid of bitplanes once so matching can work on whole words.
+		// The corner method needs them too, for cards whose corners cannot be read
+		if (method == Binary || method == Corner)
 		{
-			vector<KeyPoint> keyPoints;
-			Mat descriptors;
+			deck[i].pyramid = buildBitPyramid(card);
+		}
 
-			detector.detect(card, keyPoints);
-			extractor.compute(card, keyPoints, descriptors);
+		// If using a feature based method, keypoints and descriptors should only be processed once and stored for later use
+		if (isFeatureMethod(method))
+		{
+			computeFeatures(card, method, deck[i].keyPoints, deck[i].descriptors);
+		}
+	}
 
-			deck[i].keyPoints = keyPoints;
-			deck[i].descriptors = descriptors;
-		}	
+	if (!saveDeckCache(path, deck, method))
+	{
+		cout << "Could not store the deck index, it will be pre-processed again next time." << endl;
 	}
+
+	return true;
 }
 
-bool isNumber(string number)
+bool isNumber(const string &number)
 {
 	try
 	{
@@ -137,40 +195,133 @@ bool isNumber(string number)
 	return true;
 }
 
-bool compareContourArea(vector<Point> v1, vector<Point> v2)
+bool compareContourArea(const vector<Point> &v1, const vector<Point> &v2)
 {
 	// "true" avoids duplicates when sorting
 	return contourArea(v1, true) > contourArea(v2, true);
 }
 
-void appendToMat(Mat image, Mat section, int x, int y)
+#if defined(__AVX2__) || defined(__SSSE3__)
+// Per byte masks used to gather the other channels of each pixel from the neighbouring bytes (shifted by -2, -1, +1, +2).
+// A group is 16 pixels (three 16 byte chunks), the position of each byte within its pixel depends on the chunk
+struct TransparentMasks
 {
-	for (int i = 0; i < section.rows; i++)
+	__m128i previous2[3], previous1[3], next1[3], next2[3];
+
+	TransparentMasks()
 	{
-		for (int j = 0; j < section.cols; j++)
+		for (int chunk = 0; chunk < 3; chunk++)
 		{
-			Vec3b pixel = section.at<Vec3b>(i, j);
-			image.at<Vec3b>(i + y, j + x) = pixel;
+			uchar p2[16], p1[16], n1[16], n2[16];
+
+			for (int i = 0; i < 16; i++)
+			{
+				int channel = (16 * chunk + i) % 3;
+				p2[i] = channel == 2 ? 0xff : 0;
+				p1[i] = channel >= 1 ? 0xff : 0;
+				n1[i] = channel <= 1 ? 0xff : 0;
+				n2[i] = channel == 0 ? 0xff : 0;
+			}
+
+			previous2[chunk] = _mm_loadu_si128((const __m128i *)p2);
+			previous1[chunk] = _mm_loadu_si128((const __m128i *)p1);
+			next1[chunk] = _mm_loadu_si128((const __m128i *)n1);
+			next2[chunk] = _mm_loadu_si128((const __m128i *)n2);
 		}
 	}
-}
+};
+#endif
 
-void copyTransparent(Mat &image1, Mat image2)
+// Copies the non-black pixels of a BGR row onto another
+static void copyTransparentRow(uchar *destination, const uchar *source, int pixels)
 {
-	for (int i = 0; i < image2.size().height; i++)
+	int j = 0;
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+	static const TransparentMasks masks;
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; j + 16 <= pixels; j += 16)
+	{
+		const uchar *src = source + 3 * j;
+		uchar *dst = destination + 3 * j;
+		__m128i chunks[3];
+
+		chunks[0] = _mm_loadu_si128((const __m128i *)src);
+		chunks[1] = _mm_loadu_si128((const __m128i *)(src + 16));
+		chunks[2] = _mm_loadu_si128((const __m128i *)(src + 32));
+
+		for (int c = 0; c < 3; c++)
+		{
+			__m128i current = chunks[c];
+			__m128i previous = c > 0 ? chunks[c - 1] : zero;
+			__m128i next = c < 2 ? chunks[c + 1] : zero;
+
+			// OR of the three channels of the pixel each byte belongs to
+			__m128i any = current;
+			any = _mm_or_si128(any, _mm_and_si128(_mm_alignr_epi8(current, previous, 14), masks.previous2[c]));
+			any = _mm_or_si128(any, _mm_and_si128(_mm_alignr_epi8(current, previous, 15), masks.previous1[c]));
+			any = _mm_or_si128(any, _mm_and_si128(_mm_alignr_epi8(next, current, 1), masks.next1[c]));
+			any = _mm_or_si128(any, _mm_and_si128(_mm_alignr_epi8(next, current, 2), masks.next2[c]));
+
+			// Black pixels keep the destination
+			__m128i black = _mm_cmpeq_epi8(any, zero);
+			__m128i pixel = _mm_loadu_si128((const __m128i *)(dst + 16 * c));
+			pixel = _mm_or_si128(_mm_and_si128(black, pixel), _mm_andnot_si128(black, current));
+
+			_mm_storeu_si128((__m128i *)(dst + 16 * c), pixel);
+		}
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for (; j + 16 <= pixels; j += 16)
 	{
-		for (int j = 0; j < image2.size().width; j++)
+		uint8x16x3_t src = vld3q_u8(source + 3 * j);
+		uint8x16x3_t dst = vld3q_u8(destination + 3 * j);
+		uint8x16_t any = vorrq_u8(vorrq_u8(src.val[0], src.val[1]), src.val[2]);
+		uint8x16_t visible = vtstq_u8(any, any);
+
+		for (int c = 0; c < 3; c++)
 		{
-			Vec3b pixel = image2.at<Vec3b>(i, j);
+			dst.val[c] = vbslq_u8(visible, src.val[c], dst.val[c]);
+		}
 
-			if (pixel[0] != 0 || pixel[1] != 0|| pixel[2] != 0)
-			{
-				image1.at<Vec3b>(i, j) = pixel;
-			}
+		vst3q_u8(destination + 3 * j, dst);
+	}
+#endif
+
+	for (; j < pixels; j++)
+	{
+		const uchar *src = source + 3 * j;
+
+		if (src[0] != 0 || src[1] != 0 || src[2] != 0)
+		{
+			uchar *dst = destination + 3 * j;
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
 		}
 	}
 }
 
+void appendToMat(Mat &image, const Mat &section, int x, int y)
+{
+	size_t rowSize = section.cols * section.elemSize();
+
+	// Whole rows at a time, through row pointers so either image can be a region of a larger one
+	for (int i = 0; i < section.rows; i++)
+	{
+		memcpy(image.ptr<uchar>(i + y) + x * image.elemSize(), section.ptr<uchar>(i), rowSize);
+	}
+}
+
+void copyTransparent(Mat &image1, const Mat &image2)
+{
+	for (int i = 0; i < image2.rows; i++)
+	{
+		copyTransparentRow(image1.ptr<uchar>(i), image2.ptr<uchar>(i), image2.cols);
+	}
+}
+
 float calculateDistance(Point2f p1, Point2f p2)
 {
 	float diffY = p1.y - p2.y;
@@ -195,35 +346,206 @@ double getAngleBetweenPoints(Point pt1, Point pt2)
 
 void binaryPreprocess(Mat &image)
 {
-	cvtColor(image, image, CV_BGR2GRAY);
-	GaussianBlur(image, image, Size(5, 5), 2);
-	//threshold(image, image, 120, 255, THRESH_BINARY);
-	adaptiveThreshold(image, image, 255, 1, 1, 11, 1);
+	binaryPreprocess(image, image);
+}
+
+void binaryPreprocess(const Mat &image, Mat &processed)
+{
+	Mat gray = getWorkspace().getBuffer("binaryPreprocess/gray", image.size(), CV_8UC1);
+
+	cvtColor(image, gray, COLOR_BGR2GRAY);
+	GaussianBlur(gray, gray, Size(5, 5), 2);
+	//threshold(gray, gray, 120, 255, THRESH_BINARY);
+	adaptiveThreshold(gray, processed, 255, 1, 1, 11, 1);
+}
+
+vector<vector<Point>> getContours(const Mat &image, int maxContours, bool external, double minSolidity)
+{
+	PROFILE_SCOPE("getContours");
+
+	Workspace &workspace = getWorkspace();
+	Mat gray = workspace.getBuffer("getContours/gray", image.size(), CV_8UC1);
+	Mat edges = workspace.getBuffer("getContours/edges", image.size(), CV_8UC1);
+	double minArea = CONTOUR_MIN_AREA * image.rows * image.cols;
+
+	// Grayscale, threshold
+	cvtColor(image, gray, COLOR_BGR2GRAY);
+	threshold(gray, gray, 120, 255, THRESH_BINARY);
+
+	// Kept by each thread like its workspace, findContours then fills the points of similar frames without allocating them again
+	static thread_local vector<Vec4i> hierarchy;
+	static thread_local vector<vector<Point>> contours;
+	static thread_local vector<pair<double, int>> candidates;
+	static thread_local vector<Point> hull;
+
+	candidates.clear();
+
+	// Edge detection and contours. The outline of a card is a closed edge, whose inner side is a hole in a two level hierarchy
+	Canny(gray, edges, 0, 60, 3);
+	findContours(edges, contours, hierarchy, external ? RETR_EXTERNAL : RETR_CCOMP, CHAIN_APPROX_SIMPLE, Point(0, 0));
+
+	for (size_t i = 0; i < contours.size(); i++)
+	{
+		if (!external && hierarchy[i][3] < 0)
+		{
+			continue;
+		}
+
+		// Cheapest tests first, most contours are tiny edges that never get past the area
+		double area = contourArea(contours[i]);
+
+		if (area < minArea)
+		{
+			continue;
+		}
+
+		Size2f size = minAreaRect(contours[i]).size;
+
+		if (max(size.width, size.height) > CONTOUR_MAX_ELONGATION * min(size.width, size.height))
+		{
+			continue;
+		}
+
+		convexHull(contours[i], hull);
+
+		if (area < minSolidity * contourArea(hull))
+		{
+			continue;
+		}
+
+		candidates.push_back(make_pair(area, (int)i));
+	}
+
+	// Only the largest contours are ordered (by largest area), the rest are discarded
+	int count = min(maxContours, (int)candidates.size());
+
+	partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), [](const pair<double, int> &c1, const pair<double, int> &c2)
+	{
+		return c1.first > c2.first || (c1.first == c2.first && c1.second < c2.second);
+	});
+
+	vector<vector<Point>> selected(count);
+
+	// Copied rather than swapped, the reused contours keep their capacity
+	for (int i = 0; i < count; i++)
+	{
+		selected[i] = contours[candidates[i].second];
+	}
+
+	return selected;
+}
+
+bool isPlausibleCard(const Mat &image, const vector<Point> &contour, const Rectangle &rectangle, bool occluded)
+{
+	Point2f corners[] = { rectangle.p1, rectangle.p2, rectangle.p3, rectangle.p4 };
+	double area = contourArea(vector<Point2f>(corners, corners + 4));
+
+	// The fitted rectangle should cover the outline, round or ragged shapes do not. Covered cards only show part of theirs
+	if (!occluded && abs(area - contourArea(contour)) > CARD_MAX_FIT_ERROR * area)
+	{
+		PROFILE_COUNT("rejected (fit)", 1);
+		return false;
+	}
+
+	// Long sides are p1-p2 and p3-p4, perspective alone cannot stretch a card this far
+	double longSide = calculateDistance(corners[0], corners[1]) + calculateDistance(corners[2], corners[3]);
+	double shortSide = calculateDistance(corners[1], corners[2]) + calculateDistance(corners[3], corners[0]);
+
+	if (shortSide <= 0 || longSide > CARD_MAX_ASPECT * shortSide)
+	{
+		PROFILE_COUNT("rejected (aspect)", 1);
+		return false;
+	}
+
+	// Cards are mostly white, checked on a tiny warp of the card (same threshold as getContours)
+	Point2f thumbnailCorners[] = { Point2f(0, CARD_THUMBNAIL_SIZE - 1), Point2f(0, 0), Point2f(CARD_THUMBNAIL_SIZE - 1, 0),
+		Point2f(CARD_THUMBNAIL_SIZE - 1, CARD_THUMBNAIL_SIZE - 1) };
+	Workspace &workspace = getWorkspace();
+	Mat thumbnail = workspace.getBuffer("isPlausibleCard/thumbnail", Size(CARD_THUMBNAIL_SIZE, CARD_THUMBNAIL_SIZE), image.type());
+	Mat gray = workspace.getBuffer("isPlausibleCard/gray", Size(CARD_THUMBNAIL_SIZE, CARD_THUMBNAIL_SIZE), CV_8UC1);
+
+	warpPerspective(image, thumbnail, getPerspectiveTransform(corners, thumbnailCorners), thumbnail.size());
+	cvtColor(thumbnail, gray, COLOR_BGR2GRAY);
+	threshold(gray, gray, 120, 255, THRESH_BINARY);
+
+	if (countNonZero(gray) < CARD_MIN_BRIGHT * gray.total())
+	{
+		PROFILE_COUNT("rejected (brightness)", 1);
+		return false;
+	}
+
+	return true;
 }
 
-vector<vector<Point>> getContours(Mat image)
+vector<Card> findCardCandidates(const Mat &image)
 {
-	Mat processing;
-	vector<Vec4i> hierarchy;
-	vector<vector<Point>> contours;
-	vector<Point2f[4]> rectangles;
+	PROFILE_SCOPE("findCardCandidates");
+
+	// Partially covered cards are not convex, so solidity is only required to match their visible part
+	vector<vector<Point>> contours = getContours(image, INT_MAX, false, CARD_MIN_VISIBLE);
+	vector<Card> cards;
+
+	// Largest first, so a card is always accepted before any outline within it
+	for (size_t i = 0; i < contours.size(); i++)
+	{
+		Moments m = moments(contours[i]);
+
+		if (m.m00 == 0)
+		{
+			continue;
+		}
+
+		// Outlines within an accepted card (e.g. the frame of a face card) are part of it
+		Point2f center((float)(m.m10 / m.m00), (float)(m.m01 / m.m00));
+		bool nested = false;
+
+		for (size_t j = 0; j < cards.size() && !nested; j++)
+		{
+			nested = pointPolygonTest(cards[j].contours, center, false) >= 0;
+		}
+
+		if (nested)
+		{
+			continue;
+		}
+
+		vector<Point> poly;
+		approxPolyDP(contours[i], poly, CARD_POLY_EPSILON * arcLength(contours[i], true), true);
+
+		Card card;
+
+		bool occluded = poly.size() != 4 || !isContourConvex(poly);
 
-	// Grayscale, blur, threshold
-	cvtColor(image, processing, CV_BGR2GRAY);
-	GaussianBlur(processing, processing, Size(1, 1), 1000);
-	threshold(processing, processing, 120, 255, THRESH_BINARY);
+		if (!occluded)
+		{
+			card.rectangle = getCardRectangleByEquation(contours[i]);
+		}
+		else
+		{
+			// Covered by another card, the rectangle is completed from the visible part
+			if (m.m00 < CARD_MIN_VISIBLE * minAreaRect(contours[i]).size.area())
+			{
+				continue;
+			}
+
+			card.rectangle = getCardRectangle(contours[i]);
+		}
 
-	// Edge detection and contours
-	Canny(processing, processing, 0, 60, 3);
-	findContours(processing, contours, hierarchy, CV_RETR_TREE, CV_CHAIN_APPROX_SIMPLE, Point(0, 0));
+		if (!isPlausibleCard(image, contours[i], card.rectangle, occluded))
+		{
+			continue;
+		}
 
-	// Sorting by largest area
-	sort(contours.begin(), contours.end(), compareContourArea);
+		card.isNumber = false;
+		card.contours = std::move(contours[i]);
+		cards.push_back(card);
+	}
 
-	return contours;
+	PROFILE_COUNT("card candidates", cards.size());
+	return cards;
 }
 
-Rectangle getCardRectangle(vector<Point> contour)
+Rectangle getCardRectangle(const vector<Point> &contour)
 {
 	RotatedRect rotatedRect = minAreaRect(contour);
 	Point2f rectPoints[4];
@@ -243,7 +565,7 @@ Rectangle getCardRectangle(vector<Point> contour)
 	return Rectangle{ rectPoints[0], rectPoints[1], rectPoints[2], rectPoints[3] };
 }
 
-Rectangle getCardRectangleByDiagonals(vector<Point> contour)
+Rectangle getCardRectangleByDiagonals(const vector<Point> &contour)
 {
 	vector<Point> poly;
 	approxPolyDP(contour, poly, 1, true);
@@ -287,16 +609,37 @@ Rectangle getCardRectangleByDiagonals(vector<Point> contour)
 	return Rectangle{ l1.p1, l2.p1, l1.p2, l2.p2 };
 }
 
-Rectangle getCardRectangleByEquation(vector<Point> contour)
+Rectangle getCardRectangleByEquation(const vector<Point> &contour)
+{
+	Rectangle cardRectangle;
+
+	// Outlines with less than four sides have no rectangle to fit, the bounding rectangle is the closest
+	if (!getCardRectangleByEquation(contour, cardRectangle))
+	{
+		return getCardRectangle(contour);
+	}
+
+	return cardRectangle;
+}
+
+bool getCardRectangleByEquation(const vector<Point> &contour, Rectangle &rectangle)
 {
+	PROFILE_SCOPE("getCardRectangleByEquation");
+
 	// Reduce the number of points
 	vector<Point> poly;
 
 	approxPolyDP(contour, poly, 3, true);
+
+	if (poly.size() < 4)
+	{
+		return false;
+	}
+
 	poly.push_back(poly[0]); // this is done so that last point and first point are considered a line
 
-	// Create a sort-by-distance set of Line
-	set<Line, CompareLineDistance> sortbydistance;
+	// Create a sort-by-distance set of Line. Sides of the same length are all kept
+	multiset<Line, CompareLineDistance> sortbydistance;
 
 	// For each consequent two points, create a Line and add it
 	for (int i = 0; i < poly.size() - 1; i++)
@@ -319,7 +662,7 @@ Rectangle getCardRectangleByEquation(vector<Point> contour)
 	set<Line, CompareLineSequence> sortbysequence;
 
 	// Get the best 4 lines (card sides) and add them
-	set<Line>::iterator dstIt;
+	multiset<Line, CompareLineDistance>::iterator dstIt;
 	dstIt = sortbydistance.end();
 
 	for (int i = 0; i < 4; i++)
@@ -400,7 +743,15 @@ Rectangle getCardRectangleByEquation(vector<Point> contour)
 			y = l1m*x + l1b;
 		}
 
-		cardcorners.push_back(Point2f(x, y));
+		// Consecutive sides that are parallel never meet
+		if (!cvIsInf(x) && !cvIsNaN(x) && !cvIsInf(y) && !cvIsNaN(y))
+		{
+			cardcorners.push_back(Point2f(x, y));
+		}
+		else
+		{
+			return false;
+		}
 	}
 
 	// Create a rectangle
@@ -415,12 +766,22 @@ Rectangle getCardRectangleByEquation(vector<Point> contour)
 		cardRectangle.p4 = p1;
 	}
 
-	return cardRectangle;
+	rectangle = cardRectangle;
+	return true;
 }
 
-Mat getCardPerspective(Mat image, Rectangle rectangle, DetectionMethod method)
+Mat getCardPerspective(const Mat &image, const Rectangle &rectangle, DetectionMethod method)
 {
 	Mat perspective;
+
+	getCardPerspective(image, rectangle, method, perspective);
+	return perspective;
+}
+
+void getCardPerspective(const Mat &image, const Rectangle &rectangle, DetectionMethod method, Mat &perspective)
+{
+	PROFILE_SCOPE("getCardPerspective");
+
 	Point2f transformPoints[4];
 	Point2f rectanglePoints[] = { rectangle.p1, rectangle.p2, rectangle.p3, rectangle.p4 };
 
@@ -432,20 +793,24 @@ Mat getCardPerspective(Mat image, Rectangle rectangle, DetectionMethod method)
 
 	// Convert original points to the new ones via warping
 	Mat transform = getPerspectiveTransform(rectanglePoints, transformPoints);
-	warpPerspective(image, perspective, transform, Size(450, 450));
 
-	// If using the binary method, each image should also be processed
-	if (method == Binary)
+	// If using the binary or corner methods, each image should also be processed (the colour warp is only a temporary)
+	if (!isFeatureMethod(method))
 	{
-		binaryPreprocess(perspective);
-	}
+		Mat warped = getWorkspace().getBuffer("getCardPerspective/warped", Size(450, 450), image.type());
 
-	return perspective;
+		warpPerspective(image, warped, transform, Size(450, 450));
+		binaryPreprocess(warped, perspective);
+	}
+	else
+	{
+		warpPerspective(image, perspective, transform, Size(450, 450));
+	}
 }
 
-int getBinaryDiff(Mat detectedCard, Mat deckCard)
+int getBinaryDiff(const Mat &detectedCard, const Mat &deckCard)
 {
-	Mat diff;
+	Mat diff = getWorkspace().getBuffer("getBinaryDiff/diff", detectedCard.size(), detectedCard.type());
 
 	absdiff(detectedCard, deckCard, diff);
 	GaussianBlur(diff, diff, Size(5, 5), 5);
@@ -456,28 +821,32 @@ int getBinaryDiff(Mat detectedCard, Mat deckCard)
 
 void filterMatchesByAbsoluteValue(vector<DMatch> &matches, float maxDistance)
 {
-	vector<DMatch> filteredMatches;
+	size_t kept = 0;
 
+	// Compacted in place, so filtering never allocates
 	for (size_t i = 0; i < matches.size(); i++)
 	{
 		if (matches[i].distance < maxDistance)
 		{
-			filteredMatches.push_back(matches[i]);
+			matches[kept++] = matches[i];
 		}
 	}
 
-	matches = filteredMatches;
+	matches.resize(kept);
 }
 
-Mat filterMatchesRANSAC(vector<DMatch> &matches, vector<KeyPoint> &keypointsA, vector<KeyPoint> &keypointsB, double threshold)
+Mat filterMatchesRANSAC(vector<DMatch> &matches, const vector<KeyPoint> &keypointsA, const vector<KeyPoint> &keypointsB, double threshold)
 {
 	Mat homography;
-	vector<DMatch> filteredMatches;
+	size_t kept = 0;
 
 	if (matches.size() >= 4)
 	{
 		vector<Point2f> srcPoints;
 		vector<Point2f> dstPoints;
+		srcPoints.reserve(matches.size());
+		dstPoints.reserve(matches.size());
+
 		for (size_t i = 0; i < matches.size(); i++)
 		{
 
@@ -486,22 +855,23 @@ Mat filterMatchesRANSAC(vector<DMatch> &matches, vector<KeyPoint> &keypointsA, v
 		}
 
 		Mat mask;
-		homography = findHomography(srcPoints, dstPoints, CV_RANSAC, threshold, mask);
+		homography = findHomography(srcPoints, dstPoints, RANSAC, threshold, mask);
 
+		// Inliers are compacted in place
 		for (int i = 0; i<mask.rows; i++)
 		{
 			if (mask.ptr<uchar>(i)[0] == 1)
 			{ 
-				filteredMatches.push_back(matches[i]);
+				matches[kept++] = matches[i];
 			}
 		}
 	}
 
-	matches = filteredMatches;
+	matches.resize(kept);
 	return homography;
 }
 
-int getSurfMatches(vector<KeyPoint> keyPoints1, Mat descriptors1, vector<KeyPoint> keyPoints2, Mat descriptors2)
+int getSurfMatches(const vector<KeyPoint> &keyPoints1, const Mat &descriptors1, const vector<KeyPoint> &keyPoints2, const Mat &descriptors2)
 {
 	FlannBasedMatcher matcher;
 	double maxDist = 0.2;
@@ -514,120 +884,1295 @@ int getSurfMatches(vector<KeyPoint> keyPoints1, Mat descriptors1, vector<KeyPoin
 	return (int)matches.size();
 }
 
-int detectCardBinary(Mat card, Mat flipped, vector<Card> deck)
+vector<pair<int, int>> rankBinaryCandidates(const vector<BitPlane> &card, const vector<BitPlane> &flipped, const vector<Card> &deck,
+	const vector<int> &candidates, int level, int tolerance, int maxCandidates)
 {
-	int bestDiff = INT_MAX;
-	int bestIndex;
+	vector<pair<int, int>> ranking(candidates.size());
 
-	// Compare card with all cards in the deck, and return the one with the lowest difference
-	for (size_t i = 0; i < deck.size(); i++)
+	// Each candidate writes to its own slot, so the ranking is the same whether it runs in parallel or not
+	function<void(int)> compare = [&](int i)
 	{
-		int diff = getBinaryDiff(card, deck[i].image);
-		int flippedDiff = getBinaryDiff(flipped, deck[i].image);
+		const BitPlane &deckCard = deck[candidates[i]].pyramid[level];
+
+		int diff = getBitPlaneDiff(card[level], deckCard, tolerance);
+		int flippedDiff = getBitPlaneDiff(flipped[level], deckCard, tolerance);
 
-		int minDiff = min(diff, flippedDiff);
+		ranking[i] = make_pair(min(diff, flippedDiff), candidates[i]);
+	};
 
-		if (minDiff < bestDiff)
+	// Coarse levels are a few hundred words per card, only full resolution is worth spreading across threads
+	if (level == BIT_PYRAMID_LEVELS - 1)
+	{
+		parallelFor((int)candidates.size(), compare);
+	}
+	else
+	{
+		for (size_t i = 0; i < candidates.size(); i++)
 		{
-			bestDiff = minDiff;
-			bestIndex = i;
+			compare(i);
 		}
 	}
 
-	return bestIndex;
+	// Ties are broken by deck index, so the result does not depend on the order of the candidates
+	sort(ranking.begin(), ranking.end());
+
+	if ((int)ranking.size() > maxCandidates)
+	{
+		ranking.resize(maxCandidates);
+	}
+
+	return ranking;
 }
 
-int detectCardSurf(Mat card, vector<Card> deck)
+// Candidates kept at each level but the finest, twice as many as will be confirmed until the last coarse level
+static int getBinaryKeep(int level, int topK)
 {
-	int bestMatches = -1;
-	int bestIndex;
-
-	SurfFeatureDetector detector(SURF_HESSIAN);
-	SurfDescriptorExtractor extractor;
-	vector<KeyPoint> keyPoints, keyPointsFlipped;
-	Mat descriptors, descriptorsFlipped;
+	return level == BIT_PYRAMID_LEVELS - 2 ? topK : topK * 2;
+}
 
-	detector.detect(card, keyPoints);
-	extractor.compute(card, keyPoints, descriptors);
+// Narrows down a ranking of the deck at level 0 through the other coarse levels of the pyramid
+static vector<int> refineBinaryCandidates(const vector<BitPlane> &card, const vector<BitPlane> &flipped, const vector<Card> &deck,
+	vector<pair<int, int>> ranking, int topK, double margin)
+{
+	vector<int> candidates;
 
-	// Compare card with all cards in the deck, and return the one with the most matches
-	for (size_t i = 0; i < deck.size(); i++)
+	for (int level = 1; level < BIT_PYRAMID_LEVELS - 1; level++)
 	{
-		int matches = getSurfMatches(keyPoints, descriptors, deck[i].keyPoints, deck[i].descriptors);
+		candidates.clear();
 
-		if (matches > bestMatches)
+		for (size_t i = 0; i < ranking.size(); i++)
 		{
-			bestMatches = matches;
-			bestIndex = i;
+			candidates.push_back(ranking[i].second);
 		}
+
+		ranking = rankBinaryCandidates(card, flipped, deck, candidates, level, 0, getBinaryKeep(level, topK));
 	}
 
-	return bestIndex;
-}
+	candidates.clear();
 
-Card detectCard(Mat card, vector<Card> deck, DetectionMethod method)
-{
-	int cardIndex = 0;
-	
-	if (method == Binary)
+	for (size_t i = 0; i < ranking.size(); i++)
 	{
-		Mat flipped;
-		flip(card, flipped, -1);
-		cardIndex = detectCardBinary(card, flipped, deck);
+		candidates.push_back(ranking[i].second);
 	}
-	else if (method == Surf)
+
+	// A clear winner at the intermediate level does not need to be confirmed at full resolution
+	if (ranking.size() > 1 && ranking[1].first > 0 && (double)(ranking[1].first - ranking[0].first) / ranking[1].first >= margin)
 	{
-		cardIndex = detectCardSurf(card, deck);
+		candidates.resize(1);
 	}
 
-	return deck[cardIndex];
+	return candidates;
 }
 
-Mat drawCards(Mat image, vector<Card> move, vector<int> winners)
+vector<int> selectBinaryCandidates(const vector<BitPlane> &card, const vector<BitPlane> &flipped, const vector<Card> &deck, int topK, double margin)
 {
-	for (size_t i = 0; i < move.size(); i++)
-	{
-		bool winner = find(winners.begin(), winners.end(), i) != winners.end();
+	PROFILE_SCOPE("selectBinaryCandidates");
 
-		image = drawCardRectangle(image, move[i]);
-		image = drawCardValue(image, move[i], winner);
-		image = drawCardContours(image, move[i], winner);		
+	vector<int> candidates;
+
+	topK = max(topK, 1);
+
+	for (size_t i = 0; i < deck.size(); i++)
+	{
+		candidates.push_back(i);
 	}
 
-	return image;
+	// Coarse to fine: rank the whole deck at the lowest resolution, then narrow down the candidates at each level
+	vector<pair<int, int>> ranking = rankBinaryCandidates(card, flipped, deck, candidates, 0, 0, getBinaryKeep(0, topK));
+
+	return refineBinaryCandidates(card, flipped, deck, ranking, topK, margin);
 }
 
-Mat drawCardValue(Mat image, Card card, bool winner)
+vector<vector<pair<int, int>>> rankBinaryDeck(const vector<vector<BitPlane>> &cards, const vector<vector<BitPlane>> &flipped, const DeckIndex &index,
+	int maxCandidates)
 {
-	string text = card.symbol + " " + card.suit;
-	Scalar color = winner ? Scalar(0, 255, 0) : Scalar(0, 0, 255);
+	PROFILE_SCOPE("rankBinaryDeck");
 
-	// Create a new image with the same size as a card
-	Mat tmpCard = Mat::zeros(450, 450, image.type());
-	
-	// Get the original points of the card in the detected image 
-	Point2f rectanglePoints[] = { card.rectangle.p1, card.rectangle.p2, card.rectangle.p3, card.rectangle.p4 };
-	Point2f transformPoints[4];
-	transformPoints[0] = Point2f(0, 449);
-	transformPoints[1] = Point2f(0, 0);
-	transformPoints[2] = Point2f(449, 0);
-	transformPoints[3] = Point2f(449, 449);
+	int nCards = (int)cards.size();
+	int words = index.binaryCoarseWords;
+	int deckSize = words > 0 ? (int)(index.binaryCoarse.size() / words) : 0;
+	int nTiles = (nCards + BINARY_QUERY_TILE - 1) / BINARY_QUERY_TILE;
+	vector<vector<pair<int, int>>> rankings(nCards, vector<pair<int, int>>(deckSize));
 
-	// Draw text in the new card image
-	tmpCard = drawTextCentered(tmpCard, Point(225, 225), text, color);
+	// Queries are packed like the deck, each card followed by its flipped version
+	vector<uint64_t> queries((size_t)nCards * 2 * words);
 
-	// Warp the new card image to the original card position, and store the result in a new image
-	Mat tmpImage = Mat::zeros(image.size(), image.type());
-	Mat transform = getPerspectiveTransform(transformPoints, rectanglePoints);
+	for (int i = 0; i < nCards; i++)
+	{
+		copy(cards[i][0].words.get(), cards[i][0].words.get() + words, &queries[(size_t)2 * i * words]);
+		copy(flipped[i][0].words.get(), flipped[i][0].words.get() + words, &queries[(size_t)(2 * i + 1) * words]);
+	}
+
+	// Each deck card is compared against a whole tile of queries while it is in cache
+	parallelFor(nTiles, [&](int tile)
+	{
+		int first = tile * BINARY_QUERY_TILE;
+		int last = min(first + BINARY_QUERY_TILE, nCards);
+
+		for (int d = 0; d < deckSize; d++)
+		{
+			const uint64_t *deckCard = &index.binaryCoarse[(size_t)d * words];
+
+			for (int i = first; i < last; i++)
+			{
+				int diff = popcountXor(&queries[(size_t)2 * i * words], deckCard, words);
+				int flippedDiff = popcountXor(&queries[(size_t)(2 * i + 1) * words], deckCard, words);
+
+				rankings[i][d] = make_pair(min(diff, flippedDiff), d);
+			}
+		}
+
+		// Same order as rankBinaryCandidates: lowest difference first, ties by deck index
+		for (int i = first; i < last; i++)
+		{
+			int keep = min(maxCandidates, deckSize);
+
+			partial_sort(rankings[i].begin(), rankings[i].begin() + keep, rankings[i].end());
+			rankings[i].resize(keep);
+		}
+	});
+
+	return rankings;
+}
+
+// Full resolution difference between a card (either way up) and a deck card. Comparisons are abandoned once they exceed bound
+static int getConfirmationDiff(const vector<BitPlane> &card, const vector<BitPlane> &flipped, const Card &deckCard, int bound)
+{
+	int level = BIT_PYRAMID_LEVELS - 1;
+	int diff = getBitPlaneDiff(card[level], deckCard.pyramid[level], BINARY_TOLERANCE, bound);
+	int flippedDiff = getBitPlaneDiff(flipped[level], deckCard.pyramid[level], BINARY_TOLERANCE, min(bound, diff));
+
+	diff = min(diff, flippedDiff);
+
+	if (diff > bound)
+	{
+		PROFILE_COUNT("binary early exits", 1);
+	}
+
+	return diff;
+}
+
+// A difference this low is a match, there is no need to look at any other candidate
+static bool isConfirmedMatch(const vector<BitPlane> &card, int diff)
+{
+	const BitPlane &plane = card[BIT_PYRAMID_LEVELS - 1];
+
+	if (diff > BINARY_ACCEPT_DIFF * plane.rows * plane.cols)
+	{
+		return false;
+	}
+
+	PROFILE_COUNT("binary accepted early", 1);
+	return true;
+}
+
+// Lowers a bound shared between threads, once a comparison has been completed
+static void lowerBound(atomic<int> &bound, int diff)
+{
+	int current = bound.load();
+
+	while (diff < current && !bound.compare_exchange_weak(current, diff))
+	{
+	}
+}
+
+int detectCardBinary(const Mat &card, const Mat &flipped, const vector<Card> &deck, int topK, double margin)
+{
+	PROFILE_SCOPE("detectCardBinary");
+
+	vector<BitPlane> cardPyramid, flippedPyramid;
+
+	{
+		PROFILE_SCOPE("detectCardBinary/pyramid");
+		cardPyramid = buildBitPyramid(card);
+		flippedPyramid = buildBitPyramid(flipped);
+	}
+
+	vector<int> candidates = selectBinaryCandidates(cardPyramid, flippedPyramid, deck, topK, margin);
+
+	if (candidates.size() <= 1)
+	{
+		return candidates.empty() ? 0 : candidates[0];
+	}
+
+	PROFILE_SCOPE("detectCardBinary/confirm");
+	PROFILE_COUNT("binary confirmations", 1);
+
+	// Candidates come in coarse rank order, so the first one is the likeliest match and bounds the comparisons of the others
+	pair<int, int> best(getConfirmationDiff(cardPyramid, flippedPyramid, deck[candidates[0]], INT_MAX), candidates[0]);
+
+	if (isConfirmedMatch(cardPyramid, best.first))
+	{
+		return best.second;
+	}
+
+	vector<int> diffs(candidates.size() - 1);
+	atomic<int> bound(best.first);
+
+	parallelFor((int)diffs.size(), [&](int i)
+	{
+		diffs[i] = getConfirmationDiff(cardPyramid, flippedPyramid, deck[candidates[i + 1]], bound.load());
+		lowerBound(bound, diffs[i]);
+	});
+
+	// Ties are broken by deck index, as in rankBinaryCandidates. Abandoned comparisons are above the best difference, so they never win
+	for (size_t i = 0; i < diffs.size(); i++)
+	{
+		best = min(best, make_pair(diffs[i], candidates[i + 1]));
+	}
+
+	return best.second;
+}
+
+// Shared by the batched binary functions: packs every card (and its flipped version) into pyramids, then ranks the whole batch
+// against the whole deck at level 0 at once. Rankings are left empty if the index holds no packed deck
+static void prepareBinaryBatch(const vector<Mat> &cards, const DeckIndex &index, int topK, vector<vector<BitPlane>> &cardPyramids,
+	vector<vector<BitPlane>> &flippedPyramids, vector<vector<pair<int, int>>> &rankings)
+{
+	int nCards = (int)cards.size();
+
+	cardPyramids.assign(nCards, vector<BitPlane>());
+	flippedPyramids.assign(nCards, vector<BitPlane>());
+	rankings.clear();
+
+	parallelFor(nCards, [&](int i)
+	{
+		PROFILE_SCOPE("matchCardsBinary/pyramid");
+
+		Mat flipped = getWorkspace().getBuffer("matchCardsBinary/flipped", cards[i].size(), cards[i].type());
+		flip(cards[i], flipped, -1);
+
+		cardPyramids[i] = buildBitPyramid(cards[i]);
+		flippedPyramids[i] = buildBitPyramid(flipped);
+	});
+
+	if (index.binaryCoarseWords > 0)
+	{
+		rankings = rankBinaryDeck(cardPyramids, flippedPyramids, index, getBinaryKeep(0, topK));
+	}
+}
+
+vector<int> matchCardsBinary(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index, int topK, double margin)
+{
+	PROFILE_SCOPE("matchCardsBinary");
+
+	int nCards = (int)cards.size();
+	vector<vector<BitPlane>> cardPyramids, flippedPyramids;
+	vector<vector<pair<int, int>>> rankings;
+	vector<vector<int>> candidates(nCards);
+	vector<pair<int, int>> best(nCards, make_pair(INT_MAX, 0));
+	vector<atomic<int>> bounds(nCards);
+
+	topK = max(topK, 1);
+	prepareBinaryBatch(cards, index, topK, cardPyramids, flippedPyramids, rankings);
+
+	// The other coarse levels are cheap, each card narrows down its own candidates and compares the likeliest one at full resolution
+	parallelFor(nCards, [&](int i)
+	{
+		if (rankings.empty())
+		{
+			candidates[i] = selectBinaryCandidates(cardPyramids[i], flippedPyramids[i], deck, topK, margin);
+		}
+		else
+		{
+			candidates[i] = refineBinaryCandidates(cardPyramids[i], flippedPyramids[i], deck, rankings[i], topK, margin);
+		}
+
+		best[i] = make_pair(INT_MAX, candidates[i].empty() ? 0 : candidates[i][0]);
+
+		if (candidates[i].size() > 1)
+		{
+			PROFILE_SCOPE("matchCardsBinary/confirm");
+			PROFILE_COUNT("binary confirmations", 1);
+
+			best[i].first = getConfirmationDiff(cardPyramids[i], flippedPyramids[i], deck[candidates[i][0]], INT_MAX);
+
+			if (isConfirmedMatch(cardPyramids[i], best[i].first))
+			{
+				candidates[i].resize(1);
+			}
+		}
+
+		bounds[i] = best[i].first;
+	});
+
+	// Remaining comparisons of the whole batch are spread across the pool at once, instead of a few per card
+	vector<pair<int, int>> comparisons;
+
+	for (int i = 0; i < nCards; i++)
+	{
+		for (size_t j = 1; j < candidates[i].size(); j++)
+		{
+			comparisons.push_back(make_pair(i, candidates[i][j]));
+		}
+	}
+
+	vector<int> diffs(comparisons.size());
+
+	parallelFor((int)comparisons.size(), [&](int i)
+	{
+		PROFILE_SCOPE("matchCardsBinary/confirm");
+
+		int card = comparisons[i].first;
+
+		diffs[i] = getConfirmationDiff(cardPyramids[card], flippedPyramids[card], deck[comparisons[i].second], bounds[card].load());
+		lowerBound(bounds[card], diffs[i]);
+	});
+
+	// Ties are broken by deck index, as in rankBinaryCandidates
+	vector<int> matches(nCards);
+
+	for (size_t i = 0; i < comparisons.size(); i++)
+	{
+		int card = comparisons[i].first;
+		best[card] = min(best[card], make_pair(diffs[i], comparisons[i].second));
+	}
+
+	for (int i = 0; i < nCards; i++)
+	{
+		matches[i] = best[i].second;
+	}
+
+	return matches;
+}
+
+// Orders candidates by decreasing confidence (ties keep their order) and measures the margin between the first two
+static CardMatch makeCardMatch(vector<CardCandidate> candidates, DetectionMethod method)
+{
+	CardMatch match;
+
+	stable_sort(candidates.begin(), candidates.end(), [](const CardCandidate &a, const CardCandidate &b) { return a.confidence > b.confidence; });
+
+	match.candidates = candidates;
+	match.method = method;
+	match.margin = 0;
+
+	if (candidates.size() == 1)
+	{
+		match.margin = candidates[0].confidence;
+	}
+	else if (candidates.size() > 1)
+	{
+		match.margin = candidates[0].confidence - candidates[1].confidence;
+	}
+
+	return match;
+}
+
+// Packs the two lowest differences of a card in a single word (lowest in the high half), so threads can lower both at once
+static uint64_t packBestTwo(int best, int second)
+{
+	return (uint64_t)(uint32_t)best << 32 | (uint32_t)second;
+}
+
+// Lowers the two lowest differences shared between threads, once a comparison has been completed (see lowerBound)
+static void lowerBestTwo(atomic<uint64_t> &bestTwo, int diff)
+{
+	uint64_t current = bestTwo.load();
+
+	while (true)
+	{
+		int best = (int)(current >> 32);
+		int second = (int)(current & 0xFFFFFFFF);
+		uint64_t next;
+
+		if (diff < best)
+		{
+			next = packBestTwo(diff, best);
+		}
+		else if (diff < second)
+		{
+			next = packBestTwo(best, diff);
+		}
+		else
+		{
+			return;
+		}
+
+		if (bestTwo.compare_exchange_weak(current, next))
+		{
+			return;
+		}
+	}
+}
+
+vector<CardMatch> rankCardsBinary(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index, int topK)
+{
+	PROFILE_SCOPE("rankCardsBinary");
+
+	int nCards = (int)cards.size();
+	vector<vector<BitPlane>> cardPyramids, flippedPyramids;
+	vector<vector<pair<int, int>>> rankings;
+	vector<vector<int>> candidates(nCards);
+	vector<vector<pair<int, int>>> scores(nCards);
+	vector<atomic<uint64_t>> bounds(nCards);
+
+	topK = max(topK, 1);
+	prepareBinaryBatch(cards, index, topK, cardPyramids, flippedPyramids, rankings);
+
+	// No candidate is skipped at the coarse levels, the margin needs the first two at full resolution
+	double noMargin = numeric_limits<double>::infinity();
+
+	// The first two candidates in coarse rank order are the likeliest, they are scored in full and bound the comparisons of the others
+	parallelFor(nCards, [&](int i)
+	{
+		if (rankings.empty())
+		{
+			candidates[i] = selectBinaryCandidates(cardPyramids[i], flippedPyramids[i], deck, topK, noMargin);
+		}
+		else
+		{
+			candidates[i] = refineBinaryCandidates(cardPyramids[i], flippedPyramids[i], deck, rankings[i], topK, noMargin);
+		}
+
+		PROFILE_SCOPE("rankCardsBinary/confirm");
+
+		for (size_t j = 0; j < candidates[i].size() && j < 2; j++)
+		{
+			int diff = getConfirmationDiff(cardPyramids[i], flippedPyramids[i], deck[candidates[i][j]], INT_MAX);
+			scores[i].push_back(make_pair(diff, candidates[i][j]));
+		}
+
+		int best = scores[i].empty() ? INT_MAX : scores[i][0].first;
+		int second = scores[i].size() < 2 ? INT_MAX : scores[i][1].first;
+
+		bounds[i] = packBestTwo(min(best, second), max(best, second));
+	});
+
+	// Other candidates only matter if they beat the second best difference, anything above it is abandoned
+	vector<pair<int, int>> comparisons;
+
+	for (int i = 0; i < nCards; i++)
+	{
+		for (size_t j = 2; j < candidates[i].size(); j++)
+		{
+			comparisons.push_back(make_pair(i, candidates[i][j]));
+		}
+	}
+
+	vector<int> diffs(comparisons.size());
+
+	parallelFor((int)comparisons.size(), [&](int i)
+	{
+		PROFILE_SCOPE("rankCardsBinary/confirm");
+
+		int card = comparisons[i].first;
+		int second = (int)(bounds[card].load() & 0xFFFFFFFF);
+
+		diffs[i] = getConfirmationDiff(cardPyramids[card], flippedPyramids[card], deck[comparisons[i].second], second);
+		lowerBestTwo(bounds[card], diffs[i]);
+	});
+
+	for (size_t i = 0; i < comparisons.size(); i++)
+	{
+		scores[comparisons[i].first].push_back(make_pair(diffs[i], comparisons[i].second));
+	}
+
+	vector<CardMatch> matches(nCards);
+
+	for (int i = 0; i < nCards; i++)
+	{
+		const BitPlane &plane = cardPyramids[i][BIT_PYRAMID_LEVELS - 1];
+		double noConfidence = BINARY_CONFIDENCE_DIFF * plane.rows * plane.cols;
+		vector<CardCandidate> ranked;
+
+		// Ordered by difference, ties by deck index, as in matchCardsBinary. Abandoned comparisons are above the second best difference,
+		// so the first two are exact and the others come after them
+		sort(scores[i].begin(), scores[i].end());
+
+		for (size_t j = 0; j < scores[i].size(); j++)
+		{
+			CardCandidate candidate;
+			candidate.deckIndex = scores[i][j].second;
+			candidate.confidence = max(0.0, 1 - scores[i][j].first / noConfidence);
+			ranked.push_back(candidate);
+		}
+
+		matches[i] = makeCardMatch(ranked, Binary);
+	}
+
+	return matches;
+}
+
+int detectCardSurf(const Mat &card, const vector<Card> &deck, const DeckIndex &index)
+{
+	return matchCardsSurf(vector<Mat>(1, card), deck, index)[0];
+}
+
+bool isMethodAvailable(DetectionMethod method)
+{
+#ifndef HAVE_SURF
+	if (method == Surf)
+	{
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+void createFeatures(DetectionMethod method, Ptr<FeatureDetector> &detector, Ptr<DescriptorExtractor> &extractor)
+{
+	if (!isMethodAvailable(method))
+	{
+		cout << "The SURF method requires the xfeatures2d module of OpenCV (opencv_contrib)." << endl;
+		exit(-1);
+	}
+
+#if CV_MAJOR_VERSION >= 3
+	// A single object detects and describes
+	if (method == Orb)
+	{
+		detector = ORB::create(ORB_FEATURES, ORB_SCALE_FACTOR, ORB_LEVELS);
+	}
+#ifdef HAVE_SURF
+	else
+	{
+		detector = xfeatures2d::SURF::create(SURF_HESSIAN);
+	}
+#endif
+
+	extractor = detector;
+#else
+	if (method == Orb)
+	{
+		detector = new OrbFeatureDetector(ORB_FEATURES, ORB_SCALE_FACTOR, ORB_LEVELS);
+		extractor = new OrbDescriptorExtractor();
+	}
+	else
+	{
+		detector = new SurfFeatureDetector(SURF_HESSIAN);
+		extractor = new SurfDescriptorExtractor();
+	}
+#endif
+}
+
+void computeFeatures(const Mat &image, DetectionMethod method, vector<KeyPoint> &keyPoints, Mat &descriptors)
+{
+	Ptr<FeatureDetector> detector;
+	Ptr<DescriptorExtractor> extractor;
+
+	createFeatures(method, detector, extractor);
+	detector->detect(image, keyPoints);
+	extractor->compute(image, keyPoints, descriptors);
+}
+
+void computeFeatures(const Mat &image, const DeckIndex &index, vector<KeyPoint> &keyPoints, Mat &descriptors)
+{
+	PROFILE_SCOPE("computeFeatures");
+
+	DeckFeatures &features = getDeckFeatures(index);
+
+	// Kept as two calls rather than detectAndCompute, so the profile tells keypoint detection and description apart
+	{
+		PROFILE_SCOPE("computeFeatures/detect");
+		features.detector->detect(image, keyPoints);
+	}
+
+	{
+		PROFILE_SCOPE("computeFeatures/compute");
+		features.extractor->compute(image, keyPoints, descriptors);
+	}
+}
+
+// Shared by the feature based methods: votes for cards with a single k-NN query of the whole batch, then verifies the most voted ones.
+// Returns, for each card, the pairs of (inliers, deck index) of its verified candidates, by most inliers (ties in vote order)
+static vector<vector<pair<int, int>>> matchFeatures(const vector<vector<KeyPoint>> &keyPoints, const vector<Mat> &descriptors,
+	const vector<Card> &deck, const DeckIndex &index, int nNeighbours, int nCandidates, float maxDistance)
+{
+	int nCards = (int)keyPoints.size();
+	vector<vector<pair<int, int>>> rankings(nCards);
+
+	// Descriptors of the whole batch are stacked, the rows of each card start at its offset
+	Mat queries;
+	vector<int> offsets(nCards + 1, 0);
+
+	for (int i = 0; i < nCards; i++)
+	{
+		offsets[i + 1] = offsets[i] + descriptors[i].rows;
+
+		if (!descriptors[i].empty())
+		{
+			queries.push_back(descriptors[i]);
+		}
+	}
+
+	if (queries.empty() || index.featureDescriptors.empty())
+	{
+		return rankings;
+	}
+
+	// Single query for every card against the whole deck
+	vector<vector<DMatch>> neighbours;
+
+	{
+		PROFILE_SCOPE("matchFeatures/match");
+		getDeckFeatures(index).matcher->knnMatch(queries, neighbours, nNeighbours);
+	}
+
+	vector<vector<vector<DMatch>>> cardMatches(nCards, vector<vector<DMatch>>(deck.size()));
+	vector<vector<pair<int, int>>> votes(nCards);
+
+	// The nearest neighbours of each descriptor vote for the cards they belong to
+	parallelFor(nCards, [&](int i)
+	{
+		for (int row = offsets[i]; row < offsets[i + 1]; row++)
+		{
+			int query = row - offsets[i];
+
+			// Only the nearest neighbour within each card counts, as if each card had been matched on its own
+			for (size_t j = 0; j < neighbours[row].size(); j++)
+			{
+				const DMatch &neighbour = neighbours[row][j];
+				int cardId = index.featureCardIds[neighbour.trainIdx];
+
+				if (cardMatches[i][cardId].empty() || cardMatches[i][cardId].back().queryIdx != query)
+				{
+					cardMatches[i][cardId].push_back(DMatch(query, index.featureKeyPointIds[neighbour.trainIdx], neighbour.distance));
+				}
+			}
+		}
+
+		for (size_t j = 0; j < deck.size(); j++)
+		{
+			filterMatchesByAbsoluteValue(cardMatches[i][j], maxDistance);
+			votes[i].push_back(make_pair(-(int)cardMatches[i][j].size(), j));
+		}
+
+		// Most voted cards first (ties by deck index), only those are verified geometrically
+		sort(votes[i].begin(), votes[i].end());
+	});
+
+	// Candidates of the whole batch are verified in parallel, then compared in vote order so ties resolve as in a sequential run
+	vector<pair<int, int>> verifications;
+
+	for (int i = 0; i < nCards; i++)
+	{
+		for (int j = 0; j < nCandidates && j < (int)votes[i].size(); j++)
+		{
+			verifications.push_back(make_pair(i, votes[i][j].second));
+		}
+	}
+
+	parallelFor((int)verifications.size(), [&](int i)
+	{
+		PROFILE_SCOPE("matchFeatures/ransac");
+
+		int card = verifications[i].first;
+		int cardId = verifications[i].second;
+		filterMatchesRANSAC(cardMatches[card][cardId], keyPoints[card], deck[cardId].keyPoints, RANSAC_THRESHOLD);
+	});
+
+	for (size_t i = 0; i < verifications.size(); i++)
+	{
+		int card = verifications[i].first;
+		int cardId = verifications[i].second;
+
+		rankings[card].push_back(make_pair((int)cardMatches[card][cardId].size(), cardId));
+	}
+
+	for (int i = 0; i < nCards; i++)
+	{
+		stable_sort(rankings[i].begin(), rankings[i].end(), [](const pair<int, int> &a, const pair<int, int> &b) { return a.first > b.first; });
+	}
+
+	return rankings;
+}
+
+// Computes the features of every card of a batch, then ranks their nCandidates most voted cards (see matchFeatures)
+static vector<vector<pair<int, int>>> rankFeatureCandidates(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index,
+	DetectionMethod method, int nCandidates)
+{
+	int nCards = (int)cards.size();
+	vector<vector<KeyPoint>> keyPoints(nCards);
+	vector<Mat> descriptors(nCards);
+
+	parallelFor(nCards, [&](int i)
+	{
+		computeFeatures(cards[i], index, keyPoints[i], descriptors[i]);
+
+		if (method == Surf)
+		{
+			PROFILE_COUNT("surf keypoints", keyPoints[i].size());
+		}
+		else
+		{
+			PROFILE_COUNT("orb keypoints", keyPoints[i].size());
+		}
+	});
+
+	if (method == Surf)
+	{
+		return matchFeatures(keyPoints, descriptors, deck, index, SURF_NEIGHBOURS, nCandidates, (float)SURF_MAX_DIST);
+	}
+
+	return matchFeatures(keyPoints, descriptors, deck, index, ORB_NEIGHBOURS, nCandidates, (float)ORB_MAX_DIST);
+}
+
+// The most verified candidate of each card, the first card of the deck for a card with no features
+static vector<int> getBestMatches(const vector<vector<pair<int, int>>> &rankings)
+{
+	vector<int> matches(rankings.size(), 0);
+
+	for (size_t i = 0; i < rankings.size(); i++)
+	{
+		if (!rankings[i].empty())
+		{
+			matches[i] = rankings[i][0].second;
+		}
+	}
+
+	return matches;
+}
+
+vector<int> matchCardsSurf(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index)
+{
+	PROFILE_SCOPE("matchCardsSurf");
+
+	return getBestMatches(rankFeatureCandidates(cards, deck, index, Surf, SURF_CANDIDATES));
+}
+
+int detectCardOrb(const Mat &card, const vector<Card> &deck, const DeckIndex &index)
+{
+	return matchCardsOrb(vector<Mat>(1, card), deck, index)[0];
+}
+
+vector<int> matchCardsOrb(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index)
+{
+	PROFILE_SCOPE("matchCardsOrb");
+
+	return getBestMatches(rankFeatureCandidates(cards, deck, index, Orb, ORB_CANDIDATES));
+}
+
+vector<CardMatch> rankCardsFeatures(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, int topK)
+{
+	PROFILE_SCOPE("rankCardsFeatures");
+
+	// Verifies the same candidates as matchCards, and more only if topK asks for them
+	int nCandidates = max(topK, method == Surf ? SURF_CANDIDATES : ORB_CANDIDATES);
+	vector<vector<pair<int, int>>> rankings = rankFeatureCandidates(cards, deck, index, method, nCandidates);
+	vector<CardMatch> matches(cards.size());
+
+	for (size_t i = 0; i < rankings.size(); i++)
+	{
+		vector<CardCandidate> ranked;
+
+		for (int j = 0; j < (int)rankings[i].size() && j < topK; j++)
+		{
+			CardCandidate candidate;
+			candidate.deckIndex = rankings[i][j].second;
+			candidate.confidence = (double)rankings[i][j].first / (rankings[i][j].first + FEATURE_CONFIDENCE_INLIERS);
+			ranked.push_back(candidate);
+		}
+
+		// A card with no features is not anything, as in matchCards it falls back to the first card of the deck
+		if (ranked.empty())
+		{
+			CardCandidate candidate;
+			candidate.deckIndex = 0;
+			candidate.confidence = 0;
+			ranked.push_back(candidate);
+		}
+
+		matches[i] = makeCardMatch(ranked, method);
+	}
+
+	return matches;
+}
+
+int detectCardCorner(const Mat &card, const vector<Card> &deck, const DeckIndex &index)
+{
+	return matchCardsCorner(vector<Mat>(1, card), deck, index)[0];
+}
+
+// Linear scan of the signatures of the deck for the corners of a card. Returns up to maxCandidates pairs of (difference, deck index),
+// ordered by lowest difference, ties by deck index
+static vector<pair<int, int>> rankCornerSignatures(const Mat &card, const DeckIndex &index, int maxCandidates)
+{
+	CornerSignature signature = getCornerSignature(card);
+	vector<pair<int, int>> ranking(index.cornerSignatures.size());
+
+	for (size_t j = 0; j < index.cornerSignatures.size(); j++)
+	{
+		ranking[j] = make_pair(getCornerSignatureDiff(signature, index.cornerSignatures[j]), (int)j);
+	}
+
+	int keep = min(maxCandidates, (int)ranking.size());
+
+	partial_sort(ranking.begin(), ranking.begin() + keep, ranking.end());
+	ranking.resize(keep);
+
+	return ranking;
+}
+
+vector<int> matchCardsCorner(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index)
+{
+	PROFILE_SCOPE("matchCardsCorner");
+
+	int nCards = (int)cards.size();
+	int maxDiff = (int)(CORNER_MAX_DIFF * 2 * CORNER_SIGNATURE_WIDTH * CORNER_SIGNATURE_HEIGHT);
+	vector<int> matches(nCards, 0);
+	vector<int> fallbacks;
+
+	for (int i = 0; i < nCards; i++)
+	{
+		vector<pair<int, int>> ranking = rankCornerSignatures(cards[i], index, 1);
+
+		if (ranking.empty() || ranking[0].first > maxDiff)
+		{
+			fallbacks.push_back(i);
+		}
+		else
+		{
+			matches[i] = ranking[0].second;
+		}
+	}
+
+	if (fallbacks.empty())
+	{
+		return matches;
+	}
+
+	PROFILE_COUNT("corner fallbacks", fallbacks.size());
+
+	vector<Mat> unreadable;
+
+	for (size_t i = 0; i < fallbacks.size(); i++)
+	{
+		unreadable.push_back(cards[fallbacks[i]]);
+	}
+
+	vector<int> fallbackMatches = matchCardsBinary(unreadable, deck, index);
+
+	for (size_t i = 0; i < fallbacks.size(); i++)
+	{
+		matches[fallbacks[i]] = fallbackMatches[i];
+	}
+
+	return matches;
+}
+
+vector<CardMatch> rankCardsCorner(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index, int topK)
+{
+	PROFILE_SCOPE("rankCardsCorner");
+
+	int nCards = (int)cards.size();
+	int maxDiff = (int)(CORNER_MAX_DIFF * 2 * CORNER_SIGNATURE_WIDTH * CORNER_SIGNATURE_HEIGHT);
+	vector<CardMatch> matches(nCards);
+	vector<int> fallbacks;
+
+	for (int i = 0; i < nCards; i++)
+	{
+		vector<pair<int, int>> ranking = rankCornerSignatures(cards[i], index, max(topK, 1));
+
+		if (ranking.empty() || ranking[0].first > maxDiff)
+		{
+			fallbacks.push_back(i);
+			continue;
+		}
+
+		// A signature differing in CORNER_MAX_DIFF of its bits is as far as the method trusts it
+		vector<CardCandidate> ranked;
+
+		for (size_t j = 0; j < ranking.size(); j++)
+		{
+			CardCandidate candidate;
+			candidate.deckIndex = ranking[j].second;
+			candidate.confidence = max(0.0, 1 - (double)ranking[j].first / maxDiff);
+			ranked.push_back(candidate);
+		}
+
+		matches[i] = makeCardMatch(ranked, Corner);
+	}
+
+	if (fallbacks.empty())
+	{
+		return matches;
+	}
+
+	PROFILE_COUNT("corner fallbacks", fallbacks.size());
+
+	vector<Mat> unreadable;
+
+	for (size_t i = 0; i < fallbacks.size(); i++)
+	{
+		unreadable.push_back(cards[fallbacks[i]]);
+	}
+
+	vector<CardMatch> fallbackMatches = rankCardsBinary(unreadable, deck, index, topK);
+
+	for (size_t i = 0; i < fallbacks.size(); i++)
+	{
+		matches[fallbacks[i]] = fallbackMatches[i];
+	}
+
+	return matches;
+}
+
+vector<CardMatch> rankCards(const vector<Mat> &perspectives, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, int topK)
+{
+	if (method == Binary)
+	{
+		return rankCardsBinary(perspectives, deck, index, topK);
+	}
+	else if (method == Corner)
+	{
+		return rankCardsCorner(perspectives, deck, index, topK);
+	}
+	else if (isFeatureMethod(method))
+	{
+		return rankCardsFeatures(perspectives, deck, index, method, topK);
+	}
+
+	return vector<CardMatch>(perspectives.size(), makeCardMatch(vector<CardCandidate>(), method));
+}
+
+CardMatch detectCard(const Mat &perspective, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, int topK)
+{
+	return rankCards(vector<Mat>(1, perspective), deck, index, method, topK)[0];
+}
+
+vector<int> matchCards(const vector<Mat> &perspectives, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method)
+{
+	if (method == Binary)
+	{
+		return matchCardsBinary(perspectives, deck, index);
+	}
+	else if (method == Surf)
+	{
+		return matchCardsSurf(perspectives, deck, index);
+	}
+	else if (method == Corner)
+	{
+		return matchCardsCorner(perspectives, deck, index);
+	}
+	else if (method == Orb)
+	{
+		return matchCardsOrb(perspectives, deck, index);
+	}
+
+	return vector<int>(perspectives.size(), 0);
+}
+
+vector<int> identifyCards(const Mat &image, vector<Card> &cards, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method)
+{
+	// A single frame is a batch of one, its cards are moved in and back out
+	vector<vector<Card>> frames(1);
+	frames[0].swap(cards);
+
+	vector<vector<int>> matches = identifyCards(vector<Mat>(1, image), frames, deck, index, method);
+
+	cards.swap(frames[0]);
+	return matches[0];
+}
+
+vector<vector<int>> identifyCards(const vector<Mat> &images, vector<vector<Card>> &cards, const vector<Card> &deck, const DeckIndex &index,
+	DetectionMethod method)
+{
+	PROFILE_SCOPE("identifyCards");
+
+	// Cards of every frame are flattened into a single batch, remembering the frame and position of each
+	vector<pair<int, int>> owners;
+
+	for (size_t f = 0; f < cards.size(); f++)
+	{
+		for (size_t i = 0; i < cards[f].size(); i++)
+		{
+			owners.push_back(make_pair((int)f, (int)i));
+		}
+	}
+
+	PROFILE_COUNT("cards detected", owners.size());
+
+	// One buffer per card, taken on the calling thread so each card keeps its own buffer from one call to the next
+	Workspace &workspace = getWorkspace();
+	vector<Mat> perspectives(owners.size());
+
+	for (size_t k = 0; k < owners.size(); k++)
+	{
+		int type = isFeatureMethod(method) ? images[owners[k].first].type() : CV_8UC1;
+		perspectives[k] = workspace.getBuffer("identifyCards/perspective", Size(450, 450), type, k);
+	}
+
+	parallelFor((int)owners.size(), [&](int k)
+	{
+		getCardPerspective(images[owners[k].first], cards[owners[k].first][owners[k].second].rectangle, method, perspectives[k]);
+	});
+
+	vector<int> batchMatches = matchCards(perspectives, deck, index, method);
+	vector<vector<int>> matches(cards.size());
+
+	// Only the identity of the match is copied, its pre-processed values stay in the deck
+	for (size_t k = 0; k < owners.size(); k++)
+	{
+		Card &card = cards[owners[k].first][owners[k].second];
+		const Card &match = deck[batchMatches[k]];
+
+		card.isNumber = match.isNumber;
+		card.symbol = match.symbol;
+		card.suit = match.suit;
+
+		matches[owners[k].first].push_back(batchMatches[k]);
+	}
+
+	return matches;
+}
+
+vector<int> identifyCards(const Mat &image, vector<Card> &cards, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method,
+	RecognitionCache &cache)
+{
+	PROFILE_SCOPE("identifyCards/cached");
+	PROFILE_COUNT("cards detected", cards.size());
+
+	Workspace &workspace = getWorkspace();
+	vector<Mat> perspectives(cards.size());
+	vector<uint64_t> hashes(cards.size());
+	vector<int> matches(cards.size());
+
+	for (size_t i = 0; i < cards.size(); i++)
+	{
+		perspectives[i] = workspace.getBuffer("identifyCards/perspective", Size(450, 450), isFeatureMethod(method) ? image.type() : CV_8UC1, i);
+	}
+
+	// The perspective is needed anyway to tell whether the card changed, matching it is what the cache saves
+	parallelFor((int)cards.size(), [&](int i)
+	{
+		getCardPerspective(image, cards[i].rectangle, method, perspectives[i]);
+		hashes[i] = getAppearanceHash(perspectives[i]);
+	});
+
+	vector<int> missed;
+	vector<Mat> missedPerspectives;
+
+	for (size_t i = 0; i < cards.size(); i++)
+	{
+		matches[i] = cache.lookup(cards[i].rectangle, hashes[i]);
+
+		if (matches[i] < 0)
+		{
+			missed.push_back(i);
+			missedPerspectives.push_back(perspectives[i]);
+		}
+	}
+
+	if (!missed.empty())
+	{
+		vector<int> missedMatches = matchCards(missedPerspectives, deck, index, method);
+
+		for (size_t k = 0; k < missed.size(); k++)
+		{
+			matches[missed[k]] = missedMatches[k];
+			cache.store(cards[missed[k]].rectangle, hashes[missed[k]], missedMatches[k]);
+		}
+	}
+
+	cache.nextDetection();
+
+	for (size_t i = 0; i < cards.size(); i++)
+	{
+		const Card &match = deck[matches[i]];
+
+		cards[i].isNumber = match.isNumber;
+		cards[i].symbol = match.symbol;
+		cards[i].suit = match.suit;
+	}
+
+	return matches;
+}
+
+vector<CardMatch> identifyCardsCascade(const Mat &image, vector<Card> &cards, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method,
+	const vector<Card> &fallbackDeck, const DeckIndex &fallbackIndex, DetectionMethod fallbackMethod, double minMargin)
+{
+	PROFILE_SCOPE("identifyCardsCascade");
+	PROFILE_COUNT("cards detected", cards.size());
+
+	Workspace &workspace = getWorkspace();
+	vector<Mat> perspectives(cards.size());
+
+	for (size_t i = 0; i < cards.size(); i++)
+	{
+		perspectives[i] = workspace.getBuffer("identifyCards/perspective", Size(450, 450), isFeatureMethod(method) ? image.type() : CV_8UC1, i);
+	}
+
+	parallelFor((int)cards.size(), [&](int i)
+	{
+		getCardPerspective(image, cards[i].rectangle, method, perspectives[i]);
+	});
+
+	vector<CardMatch> matches = rankCards(perspectives, deck, index, method);
+
+	// Only the cards the first method is unsure about are escalated, all of them in a single batch
+	vector<int> escalated;
+
+	for (size_t i = 0; i < matches.size(); i++)
+	{
+		if (matches[i].margin < minMargin)
+		{
+			escalated.push_back(i);
+		}
+	}
+
+	PROFILE_COUNT("cascade escalations", escalated.size());
+
+	if (!escalated.empty())
+	{
+		vector<Mat> escalatedPerspectives(escalated.size());
+
+		for (size_t k = 0; k < escalated.size(); k++)
+		{
+			int type = isFeatureMethod(fallbackMethod) ? image.type() : CV_8UC1;
+			escalatedPerspectives[k] = workspace.getBuffer("identifyCardsCascade/perspective", Size(450, 450), type, k);
+		}
+
+		parallelFor((int)escalated.size(), [&](int k)
+		{
+			getCardPerspective(image, cards[escalated[k]].rectangle, fallbackMethod, escalatedPerspectives[k]);
+		});
+
+		vector<CardMatch> fallbackMatches = rankCards(escalatedPerspectives, fallbackDeck, fallbackIndex, fallbackMethod);
+
+		for (size_t k = 0; k < escalated.size(); k++)
+		{
+			matches[escalated[k]] = fallbackMatches[k];
+		}
+	}
+
+	// Both decks come from the same list, so a deck index means the same card in either
+	for (size_t i = 0; i < cards.size(); i++)
+	{
+		const Card &match = deck[matches[i].candidates.empty() ? 0 : matches[i].candidates[0].deckIndex];
+
+		cards[i].isNumber = match.isNumber;
+		cards[i].symbol = match.symbol;
+		cards[i].suit = match.suit;
+	}
+
+	return matches;
+}
+
+vector<Card> detectCardsInContours(const Mat &image, vector<vector<Point>> &contours, int nCards, const vector<Card> &deck, const DeckIndex &index,
+	DetectionMethod method)
+{
+	PROFILE_SCOPE("detectCardsInContours");
+
+	vector<Card> cards = locateCards(image, contours, nCards);
+
+	identifyCards(image, cards, deck, index, method);
+	return cards;
+}
+
+vector<Card> locateCards(const Mat &image, vector<vector<Point>> &contours, int nCards)
+{
+	PROFILE_SCOPE("locateCards");
+
+	vector<Card> cards;
+
+	// Each card keeps the position of its contour, contours that do not look like a card never reach matching
+	for (size_t i = 0; i < contours.size() && (int)cards.size() < nCards; i++)
+	{
+		Card card;
+		card.isNumber = false;
+
+		// Area and elongation were checked by getContours, a whole card is also a convex quadrilateral (covered ones are left to findCardCandidates)
+		vector<Point> poly;
+		approxPolyDP(contours[i], poly, CARD_POLY_EPSILON * arcLength(contours[i], true), true);
+
+		if (poly.size() != 4 || !isContourConvex(poly))
+		{
+			PROFILE_COUNT("rejected (shape)", 1);
+			continue;
+		}
+
+		if (!getCardRectangleByEquation(contours[i], card.rectangle) || !isPlausibleCard(image, contours[i], card.rectangle))
+		{
+			continue;
+		}
+
+		card.contours = std::move(contours[i]);
+		cards.push_back(card);
+	}
+
+	return cards;
+}
+
+Mat drawCards(Mat &image, const vector<Card> &move, const vector<int> &winners)
+{
+	PROFILE_SCOPE("drawCards");
+
+	for (size_t i = 0; i < move.size(); i++)
+	{
+		bool winner = find(winners.begin(), winners.end(), i) != winners.end();
+
+		image = drawCardRectangle(image, move[i]);
+		image = drawCardValue(image, move[i], winner);
+		image = drawCardContours(image, move[i], winner);		
+	}
+
+	return image;
+}
+
+const Mat &getCardValueTile(const Card &card, bool winner, int type)
+{
+	static mutex lock;
+	static map<string, Mat> tiles;
+
+	string text = card.symbol + " " + card.suit;
+	string key = text + (winner ? "|winner|" : "|") + to_string(type);
+
+	lock_guard<mutex> guard(lock);
+	Mat &tile = tiles[key];
+
+	// Each tile is drawn once, and never changes afterwards (map entries keep their address)
+	if (tile.empty())
+	{
+		Scalar color = winner ? Scalar(0, 255, 0) : Scalar(0, 0, 255);
+
+		tile = Mat::zeros(450, 450, type);
+		drawTextCentered(tile, Point(225, 225), text, color);
+	}
+
+	return tile;
+}
+
+Mat drawCardValue(Mat &image, const Card &card, bool winner)
+{
+	const Mat &tile = getCardValueTile(card, winner, image.type());
+
+	// Get the original points of the card in the detected image 
+	Point2f rectanglePoints[] = { card.rectangle.p1, card.rectangle.p2, card.rectangle.p3, card.rectangle.p4 };
+	Point2f transformPoints[4];
+	transformPoints[0] = Point2f(0, 449);
+	transformPoints[1] = Point2f(0, 0);
+	transformPoints[2] = Point2f(449, 0);
+	transformPoints[3] = Point2f(449, 449);
+
+	// Only the bounding box of the card can hold any text, so that is all that gets warped and combined
+	Rect roi = boundingRect(vector<Point2f>(rectanglePoints, rectanglePoints + 4)) & Rect(0, 0, image.cols, image.rows);
+
+	if (roi.area() == 0)
+	{
+		return image;
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		rectanglePoints[i] -= Point2f((float)roi.x, (float)roi.y);
+	}
+
+	// Warp the text tile to the card position within the bounding box, pixels outside the tile stay black (transparent)
+	Mat warped = getWorkspace().getBuffer("drawCardValue/warped", roi.size(), image.type());
+	Mat transform = getPerspectiveTransform(transformPoints, rectanglePoints);
+
+	warpPerspective(tile, warped, transform, roi.size());
+
+	// Combine the warped text with the detected image
+	Mat section = image(roi);
+	copyTransparent(section, warped);
 
-	warpPerspective(tmpCard, tmpImage, transform, image.size());
-	
-	// Combine the new image with the detected image
-	copyTransparent(image, tmpImage);
 	return image;
 }
 
-Mat drawTextCentered(Mat image, Point center, string text, Scalar color)
+Mat drawTextCentered(Mat &image, Point center, const string &text, Scalar color)
 {
 	int fontFace = FONT_HERSHEY_TRIPLEX;
 	int scale = 2;
@@ -640,7 +2185,7 @@ Mat drawTextCentered(Mat image, Point center, string text, Scalar color)
 	return image;
 }
 
-Mat drawCardContours(Mat image, Card card, bool winner)
+Mat drawCardContours(Mat &image, const Card &card, bool winner)
 {
 	Scalar color = winner ? Scalar(0, 255, 0) : Scalar(0, 0, 255);
 	int thickness = 3;
@@ -653,7 +2198,7 @@ Mat drawCardContours(Mat image, Card card, bool winner)
 	return image;
 }
 
-Mat drawCardRectangle(Mat image, Card card)
+Mat drawCardRectangle(Mat &image, const Card &card)
 {
 	Point2f rectanglePoints[] = { card.rectangle.p1, card.rectangle.p2, card.rectangle.p3, card.rectangle.p4 };
 
@@ -671,7 +2216,7 @@ Mat drawCardRectangle(Mat image, Card card)
 	return image;
 }
 
-Mat resizeWithLimits(Mat image, int width, int height)
+Mat resizeWithLimits(const Mat &image, int width, int height)
 {
 	if (image.size().width <= width && image.size().height <= height)
 	{
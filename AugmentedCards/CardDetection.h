@@ -1,21 +1,19 @@
 #pragma once
 
-#include <opencv\cv.h>
-#include <opencv2\core\core_c.h>
-#include <opencv2\highgui\highgui.hpp>
-#include <opencv2\imgproc\imgproc.hpp>
-#include <opencv2\features2d\features2d.hpp>
-#include <opencv2\nonfree\nonfree.hpp>
-#include <opencv2\nonfree\features2d.hpp>
+#include "OpenCV.h"
 
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <limits>
+#include <climits>
 
+#include "BitPlane.h"
 #include "Card.h"
+#include "DeckIndex.h"
 #include "DetectionMethod.h"
 #include "Lines.h"
+#include "RecognitionCache.h"
 #include "Rectangle.h"
 
 using namespace cv;
@@ -28,30 +26,104 @@ using namespace std;
 const int SURF_HESSIAN = 600;
 const double SURF_MAX_DIST = 0.125;
 const double RANSAC_THRESHOLD = 3;
+const int SURF_NEIGHBOURS = 16;
+const int SURF_CANDIDATES = 3;
+const int ORB_FEATURES = 500;
+const float ORB_SCALE_FACTOR = 1.2f;
+const int ORB_LEVELS = 8;
+const int ORB_MAX_DIST = 50;
+const int ORB_NEIGHBOURS = 16;
+const int ORB_CANDIDATES = 3;
+const int ORB_LSH_TABLES = 12;
+const int ORB_LSH_KEY_SIZE = 20;
+const int ORB_LSH_PROBES = 2;
+const int BINARY_TOLERANCE = 1;
+const int BINARY_TOP_K = 3;
+const double BINARY_MARGIN = 0.2;
+const double BINARY_ACCEPT_DIFF = 0.008;
+const int BINARY_QUERY_TILE = 8;
+const double CORNER_MAX_DIFF = 0.25;
+const int MATCH_TOP_K = 3;
+const double BINARY_CONFIDENCE_DIFF = 0.15;
+const int FEATURE_CONFIDENCE_INLIERS = 10;
+const double CASCADE_MIN_MARGIN = 0.03;
+
+// Slow method of a cascade (see identifyCardsCascade), ORB when SURF is not available
+#ifdef HAVE_SURF
+const DetectionMethod CASCADE_FALLBACK = Surf;
+#else
+const DetectionMethod CASCADE_FALLBACK = Orb;
+#endif
+const double CONTOUR_MIN_AREA = 0.005;
+const double CONTOUR_MAX_ELONGATION = 3;
+const double CONTOUR_MIN_SOLIDITY = 0.9;
+const double CARD_MIN_VISIBLE = 0.6;
+const double CARD_POLY_EPSILON = 0.02;
+const double CARD_MAX_FIT_ERROR = 0.1;
+const double CARD_MAX_ASPECT = 2.2;
+const double CARD_MIN_BRIGHT = 0.4;
+const int CARD_THUMBNAIL_SIZE = 16;
+
+/* A deck card that a detected card may be, with a confidence between 0 (nothing alike) and 1 (identical). */
+struct CardCandidate
+{
+	int deckIndex;
+	double confidence;
+};
+
+/* The candidates for a detected card, by decreasing confidence, and the method that ranked them (see rankCards).
+ * The margin is the confidence of the first candidate minus that of the second (or that of the only one). */
+struct CardMatch
+{
+	vector<CardCandidate> candidates;
+	double margin;
+	DetectionMethod method;
+};
 
 /* Generates and stores a deck (as image) to disk. */
-void train(string filename, int nCards, DetectionMethod method);
+void train(const string &filename, int nCards, DetectionMethod method);
 
-/* Reads a file containing all the cards (as pairs of symbols/suits) in a deck. */
-vector<Card> readDeckList(string filename);
+/* Reads a file containing all the cards (as pairs of symbols/suits) in a deck. Exits if it cannot be read. */
+vector<Card> readDeckList(const string &filename);
 
-/* Reads an image containing all the cards in a deck and appends each card, as an image, to an existing vector. */
-void readDeckImage(string filename, vector<Card> &deck, DetectionMethod method);
+/* Same as above, returning false instead of exiting. */
+bool loadDeckList(const string &filename, vector<Card> &deck);
+
+/* Reads an image containing all the cards in a deck and appends each card, as an image, to an existing vector. Exits on errors.
+ * The pre-processed deck is stored as an index (see DeckCache.h), which is used instead while the deck files are unchanged. */
+void readDeckImage(const string &filename, vector<Card> &deck, DetectionMethod method);
+
+/* Same as above, returning false instead of exiting (the method should be checked with isMethodAvailable first). */
+bool loadDeckImage(const string &filename, vector<Card> &deck, DetectionMethod method);
+
+/* Returns the filename of the deck image for a given method. */
+string getDeckImageName(DetectionMethod method);
 
 /* Checks whether a given string is a number. */
-bool isNumber(string number);
+bool isNumber(const string &number);
+
+/* Returns the card-shaped contours in an image (large enough, not too elongated, at least minSolidity of their hull), largest first.
+ * Only the largest maxContours are kept. The inner side of each outline is returned, unless external is set (outer side, cheaper). */
+vector<vector<Point>> getContours(const Mat &image, int maxContours = INT_MAX, bool external = false, double minSolidity = CONTOUR_MIN_SOLIDITY);
+
+/* Returns every card in an image, ordered by largest area, with only its contours and rectangle set (see identifyCards).
+ * Partially covered cards are kept while CARD_MIN_VISIBLE of them shows, outlines within another card are discarded. */
+vector<Card> findCardCandidates(const Mat &image);
 
-/* Returns all the contours in an image ordered by largest area. */
-vector<vector<Point>> getContours(Mat image);
+/* Cheap check of whether a contour and its rectangle can be a card: fit (skipped if occluded), aspect and brightness of a thumbnail.
+ * Each rejection is counted by the profiler, by reason. */
+bool isPlausibleCard(const Mat &image, const vector<Point> &contour, const Rectangle &rectangle, bool occluded = false);
 
-/* Auxiliar to getContours, used for sorting a vector by the area of a set of points. */
-bool compareContourArea(vector<Point> v1, vector<Point> v2);
+/* Sorting criteria for a vector by the area of a set of points. Superseded by the selection in getContours. */
+bool compareContourArea(const vector<Point> &v1, const vector<Point> &v2);
 
-/* Appends an image to another at a specific section. The section to be appended should be smaller than the image it is appended to. */
-void appendToMat(Mat image, Mat section, int x, int y);
+/* Appends an image to another at a specific section. The section to be appended should be smaller than the image it is appended to,
+ * and share its type. */
+void appendToMat(Mat &image, const Mat &section, int x, int y);
 
-/* Pastes an image on top of another. Black sections in the second image are treated as a mask, and are ignored. */
-void copyTransparent(Mat &image1, Mat image2);
+/* Pastes an image on top of another (BGR, same size). Black sections in the second image are treated as a mask, and are ignored.
+ * Either image can be a region of a larger one, e.g. to restrict the work to a bounding box. Uses SSSE3/AVX2 or NEON when available. */
+void copyTransparent(Mat &image1, const Mat &image2);
 
 /* Returns the distance between two points. */
 float calculateDistance(Point2f p1, Point2f p2);
@@ -61,58 +133,173 @@ double getAngleBetweenPoints(Point pt1, Point pt2);
 
 /* Returns the four points representing a rectangle in a list of points defining a closed section (contours). 
  * Uses OpenCV's internal functions (minAreaRect). */
-Rectangle getCardRectangle(vector<Point> contour);
+Rectangle getCardRectangle(const vector<Point> &contour);
 
 /* Returns the four points representing a rectangle in a list of points defining a closed section (contours).
  * Uses the distance and angle between pairs of points. */
-Rectangle getCardRectangleByDiagonals(vector<Point> contour);
+Rectangle getCardRectangleByDiagonals(const vector<Point> &contour);
 
 /* Returns the four points representing a rectangle in a list of points defining a closed section (contours).
  * Uses the equations for the lines formed between pairs of points. */
-Rectangle getCardRectangleByEquation(vector<Point> contour);
+Rectangle getCardRectangleByEquation(const vector<Point> &contour);
+
+/* Same as above, but fails (returning false) when the contour has less than four sides or two consecutive sides never meet,
+ * instead of falling back to the bounding rectangle (see getCardRectangle). */
+bool getCardRectangleByEquation(const vector<Point> &contour, Rectangle &rectangle);
 
 /* Pre-processing applied to each card during the binary method.
  * Black and white -> blur -> threshold. Removes noise and provides better contours. */
 void binaryPreprocess(Mat &image);
 
+/* Same as above, writing into a separate image. Intermediate images come from the thread's workspace (see Workspace.h). */
+void binaryPreprocess(const Mat &image, Mat &processed);
+
 /* Converts the section formed by a rectangle (card) to a new image with a warping processing. */
-Mat getCardPerspective(Mat image, Rectangle rectangle, DetectionMethod method);
+Mat getCardPerspective(const Mat &image, const Rectangle &rectangle, DetectionMethod method);
+
+/* Same as above, writing into an existing image. No memory is allocated if it already has the right size and type
+ * (450x450, grayscale for the binary and corner methods and the type of the image for the feature based ones). */
+void getCardPerspective(const Mat &image, const Rectangle &rectangle, DetectionMethod method, Mat &perspective);
+
+/* Given an image of a card and a deck (along with its index), returns its topK closest matches with their confidence (see rankCards). */
+CardMatch detectCard(const Mat &perspective, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, int topK = MATCH_TOP_K);
+
+/* Detects the cards outlined by the first nCards plausible contours of an image (see locateCards), as a single batch (see identifyCards).
+ * Each detected card holds the identity of its match in the deck, along with its own contour and rectangle. Contours are moved out. */
+vector<Card> detectCardsInContours(const Mat &image, vector<vector<Point>> &contours, int nCards, const vector<Card> &deck, const DeckIndex &index,
+	DetectionMethod method);
+
+/* Fits a rectangle to each contour, in order, and returns the first nCards that look like a card (see isPlausibleCard).
+ * Only their contours and rectangles are set. Contours are moved out. */
+vector<Card> locateCards(const Mat &image, vector<vector<Point>> &contours, int nCards);
+
+/* Sets the identity of every card located in an image (by its rectangle), matching all of them as a single batch.
+ * Returns the deck index of each match. */
+vector<int> identifyCards(const Mat &image, vector<Card> &cards, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method);
+
+/* Same as identifyCards, for the cards located in each of several frames (cards[i] in images[i]). The cards of all frames are
+ * matched as a single batch, so the deck is walked once for the whole set rather than once per frame. Returns the matches per frame. */
+vector<vector<int>> identifyCards(const vector<Mat> &images, vector<vector<Card>> &cards, const vector<Card> &deck, const DeckIndex &index,
+	DetectionMethod method);
+
+/* Same as identifyCards, for consecutive detections in a video: cards that did not move since the previous detection take their
+ * identity from the cache, only the others are matched. Ends the detection of the cache. */
+vector<int> identifyCards(const Mat &image, vector<Card> &cards, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method,
+	RecognitionCache &cache);
+
+/* Given the images of several cards, returns the deck index of the closest match of each (the best candidate of detectCard).
+ * The most expensive steps of the whole batch share a single query or parallel loop. */
+vector<int> matchCards(const vector<Mat> &perspectives, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method);
+
+/* Given the images of several cards, returns the topK closest matches of each, as a single batch (see matchCards).
+ * Confidence is relative to BINARY_CONFIDENCE_DIFF, CORNER_MAX_DIFF or FEATURE_CONFIDENCE_INLIERS, depending on the method. */
+vector<CardMatch> rankCards(const vector<Mat> &perspectives, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method,
+	int topK = MATCH_TOP_K);
+
+/* Ranks every card with a fast method, then again with a slower one those whose margin is below minMargin, as a single batch.
+ * Both decks must come from the same deck list. Sets the identity of every card and returns its match. */
+vector<CardMatch> identifyCardsCascade(const Mat &image, vector<Card> &cards, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method,
+	const vector<Card> &fallbackDeck, const DeckIndex &fallbackIndex, DetectionMethod fallbackMethod, double minMargin = CASCADE_MIN_MARGIN);
 
-/* Given an image of a card and a deck, returns the closest match. */
-Card detectCard(Mat perspective, vector<Card> deck, DetectionMethod method);
+/* Returns the deck index of the closest match of a single card, using the Binary method. Every card is ranked at the coarsest level,
+ * the best topK are confirmed at full resolution unless the first one leads by margin (see BINARY_ACCEPT_DIFF for early acceptance). */
+int detectCardBinary(const Mat &card, const Mat &flipped, const vector<Card> &deck, int topK = BINARY_TOP_K, double margin = BINARY_MARGIN);
 
-/* Auxiliar to detectCard, attempts to match cards using the Binary method. */
-int detectCardBinary(Mat card, Mat flipped, vector<Card> deck);
+/* Auxiliar to matchCards, batched version of detectCardBinary. Each card compares its best ranked candidate first,
+ * then the full resolution comparisons of the remaining candidates of every card run in one parallel loop. */
+vector<int> matchCardsBinary(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index, int topK = BINARY_TOP_K,
+	double margin = BINARY_MARGIN);
 
-/* Auxiliar to detectCardBinary, returns the number of differences between two images in pixels. */
-int getBinaryDiff(Mat detectedCard, Mat deckCard);
+/* Auxiliar to matchCardsBinary, ranks the whole deck at level 0 for a batch of cards with a single XOR-popcount over [cards x deck].
+ * Returns the same ranking as rankBinaryCandidates over the whole deck. */
+vector<vector<pair<int, int>>> rankBinaryDeck(const vector<vector<BitPlane>> &cards, const vector<vector<BitPlane>> &flipped, const DeckIndex &index,
+	int maxCandidates);
 
-/* Auxiliar to detectCard, attempts to match cards using the SURF method. */
-int detectCardSurf(Mat card, vector<Card> deck);
+/* Auxiliar to rankCards, Binary method. Only the best two candidates are scored in full, the others are abandoned once they exceed
+ * the second best difference, so their confidence is only an upper bound. */
+vector<CardMatch> rankCardsBinary(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index, int topK);
 
-/* Auxiliar to detectCardSurf, returns the number of matches between two images in pixels. */
-int getSurfMatches(vector<KeyPoint> keyPoints1, Mat descriptors1, vector<KeyPoint> keyPoints2, Mat descriptors2);
+/* Auxiliar to detectCardBinary, narrows down the deck at the coarse levels of the pyramid. Returns the topK candidates to be confirmed
+ * at full resolution, or only the best one if it beats the second one by more than margin. */
+vector<int> selectBinaryCandidates(const vector<BitPlane> &card, const vector<BitPlane> &flipped, const vector<Card> &deck, int topK, double margin);
+
+/* Auxiliar to detectCardBinary, ranks a set of deck cards at one level of the pyramid.
+ * Returns up to maxCandidates pairs of (difference, deck index), ordered by lowest difference. */
+vector<pair<int, int>> rankBinaryCandidates(const vector<BitPlane> &card, const vector<BitPlane> &flipped, const vector<Card> &deck,
+	const vector<int> &candidates, int level, int tolerance, int maxCandidates);
+
+/* Returns the number of differences between two images in pixels (blur + threshold over the absolute difference).
+ * Superseded by getBitPlaneDiff in detectCardBinary, kept as a reference implementation. */
+int getBinaryDiff(const Mat &detectedCard, const Mat &deckCard);
+
+/* Whether this build supports a method: SURF requires the xfeatures2d module of OpenCV. */
+bool isMethodAvailable(DetectionMethod method);
+
+/* Creates the keypoint detector and descriptor extractor of a feature based method (SURF or ORB, see isFeatureMethod). */
+void createFeatures(DetectionMethod method, Ptr<FeatureDetector> &detector, Ptr<DescriptorExtractor> &extractor);
+
+/* Computes the keypoints and descriptors of an image for a feature based method, with a detector and extractor of its own. */
+void computeFeatures(const Mat &image, DetectionMethod method, vector<KeyPoint> &keyPoints, Mat &descriptors);
+
+/* Same as above, reusing the detector and extractor of a deck index for the calling thread (see getDeckFeatures). */
+void computeFeatures(const Mat &image, const DeckIndex &index, vector<KeyPoint> &keyPoints, Mat &descriptors);
+
+/* Returns the deck index of the closest match of a single card, using the SURF method.
+ * A single k-NN query against the deck index votes for cards, and only the most voted candidates are verified with RANSAC. */
+int detectCardSurf(const Mat &card, const vector<Card> &deck, const DeckIndex &index);
+
+/* Auxiliar to matchCards, batched version of detectCardSurf. The descriptors of every card are stacked into a single k-NN query,
+ * and the RANSAC verifications of every card run in one parallel loop. */
+vector<int> matchCardsSurf(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index);
+
+/* Returns the deck index of the closest match of a single card, using the ORB method. Same voting and verification as detectCardSurf,
+ * but binary descriptors are compared by Hamming distance (at most ORB_MAX_DIST bits) through a multi-probe LSH index of the deck. */
+int detectCardOrb(const Mat &card, const vector<Card> &deck, const DeckIndex &index);
+
+/* Auxiliar to matchCards, batched version of detectCardOrb. */
+vector<int> matchCardsOrb(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index);
+
+/* Auxiliar to rankCards, SURF and ORB methods. The candidates are the most verified cards, by inliers after RANSAC. */
+vector<CardMatch> rankCardsFeatures(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, int topK);
+
+/* Returns the deck index of the closest match of a single card, using the Corner method (see CornerSignature.h).
+ * Cards whose closest signature differs in more than CORNER_MAX_DIFF of its bits fall back to the Binary method. */
+int detectCardCorner(const Mat &card, const vector<Card> &deck, const DeckIndex &index);
+
+/* Auxiliar to matchCards, batched version of detectCardCorner. Every fallback is matched as a single batch (see matchCardsBinary). */
+vector<int> matchCardsCorner(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index);
+
+/* Auxiliar to rankCards, Corner method. Cards falling back to the Binary method are ranked as a single batch (see rankCardsBinary). */
+vector<CardMatch> rankCardsCorner(const vector<Mat> &cards, const vector<Card> &deck, const DeckIndex &index, int topK);
+
+/* Returns the number of matches between two images, training a matcher for the pair.
+ * Superseded by the deck index in detectCardSurf, kept as a reference implementation. */
+int getSurfMatches(const vector<KeyPoint> &keyPoints1, const Mat &descriptors1, const vector<KeyPoint> &keyPoints2, const Mat &descriptors2);
 
 /* Auxiliar to getSurfMatches, filters matches by distance. */
 void filterMatchesByAbsoluteValue(std::vector<DMatch> &matches, float maxDistance);
 
 /* Auxiliar to getSurfMatches, filters matches using RANSAC. */
-Mat filterMatchesRANSAC(vector<DMatch> &matches, vector<KeyPoint> &keypointsA, vector<KeyPoint> &keypointsB, double threshold);
+Mat filterMatchesRANSAC(vector<DMatch> &matches, const vector<KeyPoint> &keypointsA, const vector<KeyPoint> &keypointsB, double threshold);
 
 /* Draws card values, contours and defining points (rectangle) in a given image. */
-Mat drawCards(Mat image, vector<Card> move, vector<int> winners);
+Mat drawCards(Mat &image, const vector<Card> &move, const vector<int> &winners);
+
+/* Draws the value for a given card in an image. Only the bounding box of the card is warped and blended. */
+Mat drawCardValue(Mat &image, const Card &card, bool winner);
 
-/* Draws the value for a given card in an image. */
-Mat drawCardValue(Mat image, Card card, bool winner);
+/* Auxiliar to drawCardValue, returns the value of a card drawn on a card sized (450x450) black tile.
+ * Tiles are drawn once per card, colour (winner or not) and image type, then cached for the following frames. */
+const Mat &getCardValueTile(const Card &card, bool winner, int type);
 
 /* Draws text in an image, centered within a point. */
-Mat drawTextCentered(Mat image, Point center, string text, Scalar color);
+Mat drawTextCentered(Mat &image, Point center, const string &text, Scalar color);
 
 /* Draws the contours for a given card in an image. */
-Mat drawCardContours(Mat image, Card card, bool winner);
+Mat drawCardContours(Mat &image, const Card &card, bool winner);
 
 /* Draws the rectangle (points and lines) for a given card in an image. */
-Mat drawCardRectangle(Mat image, Card card);
+Mat drawCardRectangle(Mat &image, const Card &card);
 
 /* Resizes an image within the given limits. Maintains proportions. */
-Mat resizeWithLimits(Mat image, int width, int height);
\ No newline at end of file
+Mat resizeWithLimits(const Mat &image, int width, int height);
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "CardDetector.h"
+#include "CardDetection.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+CardDetector::CardDetector(const string &deckPath, DetectionMethod method, int nCards)
+{
+	this->method = method;
+	this->nCards = nCards;
+	this->deckPath = deckPath;
+
+	cascade = false;
+	fallbackMethod = method;
+	minMargin = 0;
+
+	// Errors are left to the caller, unlike readDeckList / readDeckImage which exit
+	valid = isMethodAvailable(method) && loadDeckList(deckPath, deck) && loadDeckImage(deckPath, deck, method);
+
+	if (valid)
+	{
+		index = buildDeckIndex(deck, method);
+	}
+}
+
+bool CardDetector::isValid() const
+{
+	return valid;
+}
+
+vector<Card> CardDetector::locate(const Mat &image) const
+{
+	if (nCards == 0)
+	{
+		return findCardCandidates(image);
+	}
+
+	// Anything that does not look like a card is skipped before matching
+	vector<vector<Point>> contours = getContours(image);
+	vector<Card> cards = locateCards(image, contours, nCards);
+
+	if ((int)cards.size() < nCards)
+	{
+		return vector<Card>();
+	}
+
+	return cards;
+}
+
+vector<DetectedCard> CardDetector::toDetected(const vector<Card> &cards, const vector<int> &matches) const
+{
+	vector<DetectedCard> detected(cards.size());
+
+	for (size_t i = 0; i < cards.size(); i++)
+	{
+		detected[i].deckIndex = matches[i];
+		detected[i].isNumber = cards[i].isNumber;
+		detected[i].symbol = cards[i].symbol;
+		detected[i].suit = cards[i].suit;
+		detected[i].contour = cards[i].contours;
+		detected[i].rectangle = cards[i].rectangle;
+		detected[i].confidence = -1;
+		detected[i].margin = -1;
+	}
+
+	return detected;
+}
+
+vector<DetectedCard> CardDetector::detect(const Mat &image) const
+{
+	PROFILE_SCOPE("CardDetector::detect");
+
+	if (!valid)
+	{
+		return vector<DetectedCard>();
+	}
+
+	vector<Card> cards = locate(image);
+
+	if (cards.empty())
+	{
+		return vector<DetectedCard>();
+	}
+
+	if (!cascade)
+	{
+		vector<int> matches = identifyCards(image, cards, deck, index, method);
+		return toDetected(cards, matches);
+	}
+
+	vector<CardMatch> scored = identifyCardsCascade(image, cards, deck, index, method, fallbackDeck, fallbackIndex, fallbackMethod, minMargin);
+	vector<int> matches(scored.size(), 0);
+
+	for (size_t i = 0; i < scored.size(); i++)
+	{
+		if (!scored[i].candidates.empty())
+		{
+			matches[i] = scored[i].candidates[0].deckIndex;
+		}
+	}
+
+	vector<DetectedCard> detected = toDetected(cards, matches);
+
+	for (size_t i = 0; i < scored.size(); i++)
+	{
+		detected[i].confidence = scored[i].candidates.empty() ? 0 : scored[i].candidates[0].confidence;
+		detected[i].margin = scored[i].margin;
+	}
+
+	return detected;
+}
+
+vector<vector<DetectedCard>> CardDetector::detect(const vector<Mat> &images) const
+{
+	PROFILE_SCOPE("CardDetector::detect/frames");
+
+	vector<vector<Card>> cards(images.size());
+	vector<vector<DetectedCard>> detected(images.size());
+
+	if (!valid)
+	{
+		return detected;
+	}
+
+	// A cascade escalates the cards of each frame on its own
+	if (cascade)
+	{
+		parallelFor((int)images.size(), [&](int i)
+		{
+			detected[i] = detect(images[i]);
+		});
+
+		return detected;
+	}
+
+	// Frames are located independently, then their cards are matched together
+	parallelFor((int)images.size(), [&](int i)
+	{
+		cards[i] = locate(images[i]);
+	});
+
+	vector<vector<int>> matches = identifyCards(images, cards, deck, index, method);
+
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		detected[i] = toDetected(cards[i], matches[i]);
+	}
+
+	return detected;
+}
+
+const vector<Card> &CardDetector::getDeck() const
+{
+	return deck;
+}
+
+DetectionMethod CardDetector::getMethod() const
+{
+	return method;
+}
+
+bool CardDetector::setCascade(DetectionMethod fallbackMethod, double minMargin)
+{
+	vector<Card> fallbackDeck;
+
+	if (!isMethodAvailable(fallbackMethod) || !loadDeckList(deckPath, fallbackDeck) || !loadDeckImage(deckPath, fallbackDeck, fallbackMethod))
+	{
+		return false;
+	}
+
+	this->fallbackMethod = fallbackMethod;
+	this->minMargin = minMargin;
+	this->fallbackDeck = fallbackDeck;
+	fallbackIndex = buildDeckIndex(this->fallbackDeck, fallbackMethod);
+
+	cascade = true;
+	return true;
+}
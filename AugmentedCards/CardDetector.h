@@ -0,0 +1,81 @@
+#pragma once
+
+#include "OpenCV.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include "Card.h"
+#include "CardDetection.h"
+#include "DeckIndex.h"
+#include "DetectionMethod.h"
+#include "Rectangle.h"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Card detection as a reusable engine, for programs embedding it (e.g. a service) rather than the interactive application.
+ * detect can be called from several threads at once: feature detectors and matchers are per thread (see getDeckFeatures).
+ */
+
+/* A card found in a frame: its identity in the deck and where it is. */
+struct DetectedCard
+{
+	int deckIndex;
+	bool isNumber;
+	string symbol;
+	string suit;
+
+	vector<Point> contour;
+	Rectangle rectangle;
+
+	// Confidence of the match and margin over the second best candidate (see CardMatch), -1 when matches are not scored (see setCascade)
+	double confidence;
+	double margin;
+};
+
+class CardDetector
+{
+private:
+	vector<Card> deck;
+	DeckIndex index;
+	DetectionMethod method;
+	int nCards;
+	string deckPath;
+	bool valid;
+
+	bool cascade;
+	vector<Card> fallbackDeck;
+	DeckIndex fallbackIndex;
+	DetectionMethod fallbackMethod;
+	double minMargin;
+
+	vector<Card> locate(const Mat &image) const;
+	vector<DetectedCard> toDetected(const vector<Card> &cards, const vector<int> &matches) const;
+
+public:
+	/* Loads the deck in a folder (deck.txt along with the deck image or cache of the method) and builds its index, see isValid.
+	 * Frames are searched for the nCards largest cards and give no cards if there are fewer, or for every card found if nCards is 0. */
+	CardDetector(const string &deckPath, DetectionMethod method, int nCards = 0);
+
+	/* Whether the deck was loaded. An invalid detector finds no cards. */
+	bool isValid() const;
+
+	/* Returns the cards found in a frame, ordered by largest area. */
+	vector<DetectedCard> detect(const Mat &image) const;
+
+	/* Returns the cards found in each of a set of frames. Frames are located in parallel and all their cards are matched as a single
+	 * batch, so throughput (cards per second) improves with the number of frames, at the cost of the latency of the whole set. */
+	vector<vector<DetectedCard>> detect(const vector<Mat> &images) const;
+
+	/* Returns the loaded deck, in the order of deckIndex. */
+	const vector<Card> &getDeck() const;
+
+	DetectionMethod getMethod() const;
+
+	/* Turns the detector into a cascade (see identifyCardsCascade), loading the deck of the slower method from the same folder.
+	 * Not to be called while other threads are detecting. Returns false if that deck cannot be loaded. */
+	bool setCascade(DetectionMethod fallbackMethod = CASCADE_FALLBACK, double minMargin = CASCADE_MIN_MARGIN);
+};
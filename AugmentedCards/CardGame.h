@@ -14,11 +14,11 @@ using namespace std;
 class CardGame
 {
 private:
-	virtual int getCardValue(Card card) = 0;
+	virtual int getCardValue(const Card &card) = 0;
 
 public:
 	CardGame();
 	~CardGame();
-	virtual vector<int> evaluateGame(vector<Card> move) = 0;
+	virtual vector<int> evaluateGame(const vector<Card> &move) = 0;
 };
 
@@ -0,0 +1,177 @@
+#include "CardTracker.h"
+#include "CardDetection.h"
+#include "Profiler.h"
+
+CardTracker::CardTracker()
+{
+	framesSinceDetection = 0;
+}
+
+CardTracker::~CardTracker()
+{
+}
+
+void CardTracker::reset(const Mat &frame, const vector<Card> &detected)
+{
+	cards = detected;
+	corners.clear();
+	keyframeAreas.clear();
+	framesSinceDetection = 0;
+
+	cvtColor(frame, previousGray, COLOR_BGR2GRAY);
+
+	for (size_t i = 0; i < cards.size(); i++)
+	{
+		const Rectangle &rectangle = cards[i].rectangle;
+		vector<Point2f> cardCorners;
+
+		cardCorners.push_back(rectangle.p1);
+		cardCorners.push_back(rectangle.p2);
+		cardCorners.push_back(rectangle.p3);
+		cardCorners.push_back(rectangle.p4);
+
+		corners.push_back(cardCorners);
+		keyframeAreas.push_back(contourArea(cardCorners));
+	}
+}
+
+bool CardTracker::update(const Mat &frame)
+{
+	PROFILE_SCOPE("CardTracker::update");
+
+	if (cards.empty())
+	{
+		return false;
+	}
+
+	// Both grayscale frames are kept, and swapped after each frame, so neither is ever reallocated
+	cvtColor(frame, currentGray, COLOR_BGR2GRAY);
+
+	for (size_t i = 0; i < cards.size(); i++)
+	{
+		if (!trackCard(currentGray, i))
+		{
+			cards.clear();
+			return false;
+		}
+	}
+
+	cv::swap(previousGray, currentGray);
+	framesSinceDetection++;
+
+	// Tracking cannot see cards that were not there at the keyframe, so contours are checked every once in a while
+	if (framesSinceDetection % TRACKER_CHECK_INTERVAL == 0 && hasNewCards(frame))
+	{
+		cards.clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool CardTracker::trackCard(const Mat &gray, int cardIndex)
+{
+	vector<Point2f> &cardCorners = corners[cardIndex];
+	Card &card = cards[cardIndex];
+
+	// Optical flow (and its pyramids) only runs in a window around the card
+	Rect roi = boundingRect(cardCorners);
+	roi = Rect(roi.x - TRACKER_MARGIN, roi.y - TRACKER_MARGIN, roi.width + 2 * TRACKER_MARGIN, roi.height + 2 * TRACKER_MARGIN);
+	roi &= Rect(0, 0, gray.cols, gray.rows);
+
+	if (roi.area() == 0)
+	{
+		return false;
+	}
+
+	vector<Point2f> previous, next;
+	vector<uchar> status;
+	vector<float> error;
+
+	for (int i = 0; i < 4; i++)
+	{
+		previous.push_back(cardCorners[i] - Point2f((float)roi.x, (float)roi.y));
+	}
+
+	calcOpticalFlowPyrLK(previousGray(roi), gray(roi), previous, next, status, error,
+		Size(TRACKER_WINDOW, TRACKER_WINDOW), TRACKER_PYRAMID_LEVELS);
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (!status[i] || error[i] > TRACKER_MAX_ERROR)
+		{
+			return false;
+		}
+
+		next[i] += Point2f((float)roi.x, (float)roi.y);
+	}
+
+	// The tracked corners should still look like the card found at the keyframe
+	double area = contourArea(next);
+
+	if (!isContourConvex(next) || area * TRACKER_MAX_SCALE < keyframeAreas[cardIndex] || area > keyframeAreas[cardIndex] * TRACKER_MAX_SCALE)
+	{
+		return false;
+	}
+
+	// Contours follow the same motion as the corners
+	Mat transform = getPerspectiveTransform(&cardCorners[0], &next[0]);
+	vector<Point2f> contour(card.contours.begin(), card.contours.end());
+
+	if (!contour.empty())
+	{
+		perspectiveTransform(contour, contour, transform);
+	}
+
+	for (size_t i = 0; i < contour.size(); i++)
+	{
+		card.contours[i] = Point(cvRound(contour[i].x), cvRound(contour[i].y));
+	}
+
+	card.rectangle = Rectangle{ next[0], next[1], next[2], next[3] };
+	cardCorners = next;
+	return true;
+}
+
+bool CardTracker::hasNewCards(const Mat &frame)
+{
+	PROFILE_SCOPE("CardTracker::hasNewCards");
+
+	// Every contour that looks like a card, however small, should lie within one of the tracked cards
+	vector<Card> candidates = findCardCandidates(frame);
+
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		Moments m = moments(candidates[i].contours);
+
+		if (m.m00 == 0)
+		{
+			continue;
+		}
+
+		Point2f center((float)(m.m10 / m.m00), (float)(m.m01 / m.m00));
+		bool tracked = false;
+
+		for (size_t j = 0; j < corners.size() && !tracked; j++)
+		{
+			tracked = pointPolygonTest(corners[j], center, false) >= 0;
+		}
+
+		if (!tracked)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const vector<Card> &CardTracker::getCards()
+{
+	return cards;
+}
+
+int CardTracker::getFramesSinceDetection()
+{
+	return framesSinceDetection;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "OpenCV.h"
+
+#include <iostream>
+#include <vector>
+
+#include "Card.h"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Follows detected cards across video frames, so their identity only has to be looked up again when tracking is lost.
+ * The corners of each card are tracked with pyramidal Lucas-Kanade optical flow, restricted to a window around the card.
+ */
+
+const int TRACKER_MARGIN = 32;
+const int TRACKER_WINDOW = 21;
+const int TRACKER_PYRAMID_LEVELS = 3;
+const float TRACKER_MAX_ERROR = 25;
+const double TRACKER_MAX_SCALE = 1.25;
+const int TRACKER_CHECK_INTERVAL = 15;
+
+class CardTracker
+{
+private:
+	vector<Card> cards;
+	vector<vector<Point2f>> corners;
+	vector<double> keyframeAreas;
+	Mat previousGray, currentGray;
+	int framesSinceDetection;
+
+	bool trackCard(const Mat &gray, int cardIndex);
+	bool hasNewCards(const Mat &frame);
+
+public:
+	CardTracker();
+	~CardTracker();
+
+	/* Starts tracking a set of cards detected in a frame (keyframe). An empty set stops tracking. */
+	void reset(const Mat &frame, const vector<Card> &detected);
+
+	/* Follows the tracked cards into a new frame. Returns false when tracking confidence dropped
+	   or a new card appeared, in which case cards should be detected again. */
+	bool update(const Mat &frame);
+
+	/* Returns the tracked cards, with rectangles and contours at their position in the last frame. */
+	const vector<Card> &getCards();
+
+	/* Returns the number of frames tracked since the last keyframe. */
+	int getFramesSinceDetection();
+};
@@ -0,0 +1,86 @@
+#include "CornerSignature.h"
+#include "BitPlane.h"
+#include "Workspace.h"
+
+#include <cstring>
+
+// Downsamples the symbols of one corner into the words of a signature
+static void packCorner(const Mat &corner, uint64_t *words)
+{
+	Workspace &workspace = getWorkspace();
+	Mat filtered = workspace.getBuffer("packCorner/filtered", corner.size(), CV_8UC1);
+	Mat outlines = workspace.getBuffer("packCorner/outlines", corner.size(), CV_8UC1);
+	Mat cells = workspace.getBuffer("packCorner/cells", Size(CORNER_SIGNATURE_WIDTH, CORNER_SIGNATURE_HEIGHT), CV_8UC1);
+	vector<vector<Point>> contours;
+	Rect symbols;
+
+	// Speckles left by the adaptive threshold would otherwise move the bounding box
+	medianBlur(corner, filtered, 5);
+	filtered.copyTo(outlines);
+	findContours(outlines, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+	// Symbols are whatever is left inside the corner, shapes cut by its border belong to the card frame or a pip
+	for (size_t i = 0; i < contours.size(); i++)
+	{
+		Rect box = boundingRect(contours[i]);
+
+		if (box.area() < CORNER_MIN_SYMBOL_AREA || box.x == 0 || box.y == 0 || box.br().x == corner.cols || box.br().y == corner.rows)
+		{
+			continue;
+		}
+
+		symbols = symbols.area() == 0 ? box : (symbols | box);
+	}
+
+	memset(words, 0, CORNER_SIGNATURE_WORDS * sizeof(uint64_t));
+
+	if (symbols.area() == 0)
+	{
+		return;
+	}
+
+	// The bounding box is stretched to the whole signature, so small misalignments of the perspective do not matter
+	resize(filtered(symbols), cells, cells.size(), 0, 0, INTER_AREA);
+
+	for (int i = 0; i < cells.rows; i++)
+	{
+		const uchar *pixels = cells.ptr<uchar>(i);
+
+		for (int j = 0; j < cells.cols; j++)
+		{
+			int bit = i * cells.cols + j;
+
+			if (pixels[j] >= CORNER_CELL_FILL * 255)
+			{
+				words[bit >> 6] |= 1ULL << (bit & 63);
+			}
+		}
+	}
+}
+
+CornerSignature getCornerSignature(const Mat &perspective)
+{
+	CornerSignature signature;
+	Mat rotated = getWorkspace().getBuffer("getCornerSignature/rotated", CORNER_REGION.size(), CV_8UC1);
+	Rect opposite(perspective.cols - CORNER_REGION.br().x, perspective.rows - CORNER_REGION.br().y, CORNER_REGION.width, CORNER_REGION.height);
+
+	flip(perspective(opposite), rotated, -1);
+
+	packCorner(perspective(CORNER_REGION), signature.words);
+	packCorner(rotated, signature.words + CORNER_SIGNATURE_WORDS);
+
+	return signature;
+}
+
+int getCornerSignatureDiff(const CornerSignature &signature1, const CornerSignature &signature2)
+{
+	const uint64_t *words1 = signature1.words;
+	const uint64_t *words2 = signature2.words;
+
+	// An upside down card has its corners swapped
+	int diff = popcountXor(words1, words2, 2 * CORNER_SIGNATURE_WORDS);
+	int flippedDiff = popcountXor(words1, words2 + CORNER_SIGNATURE_WORDS, CORNER_SIGNATURE_WORDS) +
+		popcountXor(words1 + CORNER_SIGNATURE_WORDS, words2, CORNER_SIGNATURE_WORDS);
+
+	return min(diff, flippedDiff);
+}
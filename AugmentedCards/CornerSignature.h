@@ -0,0 +1,39 @@
+#pragma once
+
+#include "OpenCV.h"
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Signature of the rank and suit printed in the corners of a card, used by the corner method.
+ * Each corner is cropped to its symbols and downsampled to a small bitplane, so two cards are compared with a few popcounts.
+ */
+
+/* Area of the (binary, 450x450) perspective holding the top left rank and suit. The bottom right ones are found rotated by 180 degrees. */
+const Rect CORNER_REGION(8, 10, 64, 120);
+
+/* Size of each corner once downsampled, and words needed to hold it. */
+const int CORNER_SIGNATURE_WIDTH = 16;
+const int CORNER_SIGNATURE_HEIGHT = 32;
+const int CORNER_SIGNATURE_WORDS = CORNER_SIGNATURE_WIDTH * CORNER_SIGNATURE_HEIGHT / 64;
+
+/* Symbols smaller than this (bounding box area, in pixels) are treated as noise. A cell is set when this fraction of it is set. */
+const int CORNER_MIN_SYMBOL_AREA = 40;
+const double CORNER_CELL_FILL = 0.4;
+
+/* Top left corner in the first half of the words, bottom right (rotated) corner in the second. */
+struct CornerSignature
+{
+	uint64_t words[2 * CORNER_SIGNATURE_WORDS];
+};
+
+/* Returns the signature of a binary card perspective (see getCardPerspective). */
+CornerSignature getCornerSignature(const Mat &perspective);
+
+/* Returns the number of different bits between two signatures, for whichever way up the first card is. */
+int getCornerSignatureDiff(const CornerSignature &signature1, const CornerSignature &signature2);
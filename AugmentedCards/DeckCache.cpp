@@ -0,0 +1,474 @@
+#include "DeckCache.h"
+#include "CardDetection.h"
+
+#include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const char DECK_CACHE_MAGIC[8] = { 'A', 'C', 'D', 'E', 'C', 'K', '\0', '\0' };
+static const uint64_t DECK_CACHE_ALIGNMENT = 64;
+
+/* Settings the keypoints, descriptors and matcher of a deck depend on. Only those of the index's method are set, the others are 0,
+ * so tuning one method does not invalidate the index of another. */
+struct DeckCacheFeatures
+{
+	int32_t surfHessian;
+	int32_t orbFeatures;
+	float orbScaleFactor;
+	int32_t orbLevels;
+	int32_t orbLshTables;
+	int32_t orbLshKeySize;
+	int32_t orbLshProbes;
+};
+
+/* File header. Source stamps identify the deck.txt / deck image the index was built from. */
+struct DeckCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t method;
+	uint32_t cardCount;
+	DeckCacheFeatures features;
+	uint64_t fileSize;
+	uint64_t deckListHash;
+	uint64_t deckImageSize;
+	int64_t deckImageTime;
+};
+
+/* One entry per card, following the header. Offsets are relative to the start of the file. */
+struct DeckCacheEntry
+{
+	uint64_t imageOffset;
+	uint64_t keyPointOffset;
+	uint64_t descriptorOffset;
+	uint64_t pyramidOffset[BIT_PYRAMID_LEVELS];
+	int32_t imageRows, imageCols, imageType;
+	int32_t keyPointCount;
+	int32_t descriptorRows, descriptorCols, descriptorType;
+	int32_t pyramidRows[BIT_PYRAMID_LEVELS];
+	int32_t pyramidCols[BIT_PYRAMID_LEVELS];
+	int32_t pyramidStride[BIT_PYRAMID_LEVELS];
+};
+
+/* Fixed-size keypoint record, independent of the layout of KeyPoint in the installed OpenCV version. */
+struct DeckCacheKeyPoint
+{
+	float x, y, size, angle, response;
+	int32_t octave, classId;
+};
+
+/* Read-only view of a file in memory. Pages are mapped copy-on-write, so accidental writes never reach the file. */
+struct MappedFile
+{
+	const char *data;
+	size_t size;
+
+#ifdef _WIN32
+	HANDLE file, mapping;
+#endif
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		CloseHandle(file);
+#else
+		munmap((void *)data, size);
+#endif
+	}
+};
+
+static shared_ptr<MappedFile> mapFile(string filename)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return nullptr;
+	}
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	void *data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+
+	if (data == NULL)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	shared_ptr<MappedFile> mapped(new MappedFile());
+	mapped->data = (const char *)data;
+	mapped->size = (size_t)size.QuadPart;
+	mapped->file = file;
+	mapped->mapping = mapping;
+	return mapped;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		return nullptr;
+	}
+
+	struct stat info;
+
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	void *data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		return nullptr;
+	}
+
+	shared_ptr<MappedFile> mapped(new MappedFile());
+	mapped->data = (const char *)data;
+	mapped->size = (size_t)info.st_size;
+	return mapped;
+#endif
+}
+
+/* FNV-1a hash of a file's contents. Returns false if the file could not be read. */
+static bool hashFile(string filename, uint64_t &hash)
+{
+	ifstream file(filename, ios::binary);
+
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	hash = 14695981039346656037ULL;
+	char buffer[4096];
+
+	while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+	{
+		for (streamsize i = 0; i < file.gcount(); i++)
+		{
+			hash = (hash ^ (unsigned char)buffer[i]) * 1099511628211ULL;
+		}
+	}
+
+	return true;
+}
+
+/* Fills the feature settings of a header with the current ones for its method. */
+static void stampFeatureSettings(DetectionMethod method, DeckCacheFeatures &features)
+{
+	memset(&features, 0, sizeof(features));
+
+	if (method == Surf)
+	{
+		features.surfHessian = SURF_HESSIAN;
+	}
+	else if (method == Orb)
+	{
+		features.orbFeatures = ORB_FEATURES;
+		features.orbScaleFactor = ORB_SCALE_FACTOR;
+		features.orbLevels = ORB_LEVELS;
+		features.orbLshTables = ORB_LSH_TABLES;
+		features.orbLshKeySize = ORB_LSH_KEY_SIZE;
+		features.orbLshProbes = ORB_LSH_PROBES;
+	}
+}
+
+/* Returns true if an index was built with the same feature settings as the current ones. */
+static bool sameFeatureSettings(const DeckCacheFeatures &a, const DeckCacheFeatures &b)
+{
+	return a.surfHessian == b.surfHessian && a.orbFeatures == b.orbFeatures && a.orbScaleFactor == b.orbScaleFactor &&
+		a.orbLevels == b.orbLevels && a.orbLshTables == b.orbLshTables && a.orbLshKeySize == b.orbLshKeySize &&
+		a.orbLshProbes == b.orbLshProbes;
+}
+
+/* Fills the source stamps of a header: hash of deck.txt, size and modification time of the deck image. */
+static bool stampDeckSources(string path, DetectionMethod method, DeckCacheHeader &header)
+{
+	struct stat info;
+
+	if (!hashFile(path + "deck.txt", header.deckListHash) || stat((path + getDeckImageName(method)).c_str(), &info) != 0)
+	{
+		return false;
+	}
+
+	header.deckImageSize = (uint64_t)info.st_size;
+	header.deckImageTime = (int64_t)info.st_mtime;
+	return true;
+}
+
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + DECK_CACHE_ALIGNMENT - 1) / DECK_CACHE_ALIGNMENT * DECK_CACHE_ALIGNMENT;
+}
+
+static bool fitsInFile(uint64_t offset, uint64_t size, uint64_t fileSize)
+{
+	return offset <= fileSize && size <= fileSize - offset;
+}
+
+string getDeckCacheName(DetectionMethod method)
+{
+	if (method == Surf)
+	{
+		return "deck_surf.cache";
+	}
+	else if (method == Orb)
+	{
+		return "deck_orb.cache";
+	}
+
+	return method == Corner ? "deck_corner.cache" : "deck_binary.cache";
+}
+
+bool loadDeckCache(const string &path, vector<Card> &deck, DetectionMethod method)
+{
+	shared_ptr<MappedFile> file = mapFile(path + getDeckCacheName(method));
+
+	if (!file || file->size < sizeof(DeckCacheHeader))
+	{
+		return false;
+	}
+
+	// Header check: format, parameters and sources must all match the current deck
+	const DeckCacheHeader *header = (const DeckCacheHeader *)file->data;
+	DeckCacheHeader current;
+	stampFeatureSettings(method, current.features);
+
+	if (memcmp(header->magic, DECK_CACHE_MAGIC, sizeof(DECK_CACHE_MAGIC)) != 0 || header->version != DECK_CACHE_VERSION ||
+		header->method != (uint32_t)method || header->cardCount != deck.size() || !sameFeatureSettings(header->features, current.features) ||
+		header->fileSize != file->size || !stampDeckSources(path, method, current) ||
+		header->deckListHash != current.deckListHash || header->deckImageSize != current.deckImageSize ||
+		header->deckImageTime != current.deckImageTime)
+	{
+		return false;
+	}
+
+	if (!fitsInFile(sizeof(DeckCacheHeader), sizeof(DeckCacheEntry) * deck.size(), file->size))
+	{
+		return false;
+	}
+
+	const DeckCacheEntry *entries = (const DeckCacheEntry *)(file->data + sizeof(DeckCacheHeader));
+
+	// Validate every entry before touching the deck, so a damaged index never leaves it half-filled
+	for (size_t i = 0; i < deck.size(); i++)
+	{
+		const DeckCacheEntry &entry = entries[i];
+
+		if (!fitsInFile(entry.imageOffset, (uint64_t)entry.imageRows * entry.imageCols * CV_ELEM_SIZE(entry.imageType), file->size) ||
+			!fitsInFile(entry.keyPointOffset, (uint64_t)entry.keyPointCount * sizeof(DeckCacheKeyPoint), file->size) ||
+			!fitsInFile(entry.descriptorOffset, (uint64_t)entry.descriptorRows * entry.descriptorCols * CV_ELEM_SIZE(entry.descriptorType), file->size))
+		{
+			return false;
+		}
+
+		for (int level = 0; level < BIT_PYRAMID_LEVELS; level++)
+		{
+			if (entry.pyramidRows[level] == 0)
+			{
+				continue;
+			}
+
+			if (entry.pyramidRows[level] != BIT_PYRAMID_SIZES[level] || entry.pyramidCols[level] != BIT_PYRAMID_SIZES[level] ||
+				entry.pyramidStride[level] != (BIT_PYRAMID_SIZES[level] + 63) / 64 ||
+				!fitsInFile(entry.pyramidOffset[level], (uint64_t)entry.pyramidRows[level] * entry.pyramidStride[level] * sizeof(uint64_t), file->size))
+			{
+				return false;
+			}
+		}
+	}
+
+	// Images, descriptors and bitplanes point straight into the mapped file, only keypoints are copied
+	for (size_t i = 0; i < deck.size(); i++)
+	{
+		const DeckCacheEntry &entry = entries[i];
+		Card &card = deck[i];
+
+		card.image = Mat(entry.imageRows, entry.imageCols, entry.imageType, (void *)(file->data + entry.imageOffset));
+		card.descriptors = Mat(entry.descriptorRows, entry.descriptorCols, entry.descriptorType, (void *)(file->data + entry.descriptorOffset));
+
+		const DeckCacheKeyPoint *keyPoints = (const DeckCacheKeyPoint *)(file->data + entry.keyPointOffset);
+		card.keyPoints.clear();
+		card.keyPoints.reserve(entry.keyPointCount);
+
+		for (int k = 0; k < entry.keyPointCount; k++)
+		{
+			const DeckCacheKeyPoint &keyPoint = keyPoints[k];
+			card.keyPoints.push_back(KeyPoint(keyPoint.x, keyPoint.y, keyPoint.size, keyPoint.angle, keyPoint.response, keyPoint.octave, keyPoint.classId));
+		}
+
+		card.pyramid.clear();
+
+		for (int level = 0; level < BIT_PYRAMID_LEVELS && entry.pyramidRows[level] != 0; level++)
+		{
+			BitPlane plane;
+			plane.rows = entry.pyramidRows[level];
+			plane.cols = entry.pyramidCols[level];
+			plane.stride = entry.pyramidStride[level];
+			plane.words = shared_ptr<const uint64_t>(file, (const uint64_t *)(file->data + entry.pyramidOffset[level]));
+			card.pyramid.push_back(plane);
+		}
+
+		card.storage = file;
+	}
+
+	return true;
+}
+
+bool saveDeckCache(const string &path, const vector<Card> &deck, DetectionMethod method)
+{
+	string filename = path + getDeckCacheName(method);
+	string tmpFilename = filename + ".tmp";
+
+	DeckCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DECK_CACHE_MAGIC, sizeof(DECK_CACHE_MAGIC));
+	header.version = DECK_CACHE_VERSION;
+	header.method = (uint32_t)method;
+	header.cardCount = (uint32_t)deck.size();
+	stampFeatureSettings(method, header.features);
+
+	if (!stampDeckSources(path, method, header))
+	{
+		return false;
+	}
+
+	// Lay out every section first, so the header and entries can be written up front
+	vector<DeckCacheEntry> entries(deck.size());
+	uint64_t offset = alignOffset(sizeof(DeckCacheHeader) + sizeof(DeckCacheEntry) * deck.size());
+
+	for (size_t i = 0; i < deck.size(); i++)
+	{
+		const Card &card = deck[i];
+		DeckCacheEntry &entry = entries[i];
+		memset(&entry, 0, sizeof(entry));
+
+		entry.imageRows = card.image.rows;
+		entry.imageCols = card.image.cols;
+		entry.imageType = card.image.type();
+		entry.imageOffset = offset;
+		offset = alignOffset(offset + card.image.total() * card.image.elemSize());
+
+		entry.keyPointCount = (int32_t)card.keyPoints.size();
+		entry.keyPointOffset = offset;
+		offset = alignOffset(offset + card.keyPoints.size() * sizeof(DeckCacheKeyPoint));
+
+		entry.descriptorRows = card.descriptors.rows;
+		entry.descriptorCols = card.descriptors.cols;
+		entry.descriptorType = card.descriptors.type();
+		entry.descriptorOffset = offset;
+		offset = alignOffset(offset + card.descriptors.total() * card.descriptors.elemSize());
+
+		for (size_t level = 0; level < card.pyramid.size(); level++)
+		{
+			const BitPlane &plane = card.pyramid[level];
+			entry.pyramidRows[level] = plane.rows;
+			entry.pyramidCols[level] = plane.cols;
+			entry.pyramidStride[level] = plane.stride;
+			entry.pyramidOffset[level] = offset;
+			offset = alignOffset(offset + (uint64_t)plane.rows * plane.stride * sizeof(uint64_t));
+		}
+	}
+
+	header.fileSize = offset;
+
+	ofstream file(tmpFilename, ios::binary | ios::trunc);
+
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	file.write((const char *)&header, sizeof(header));
+	file.write((const char *)entries.data(), sizeof(DeckCacheEntry) * entries.size());
+
+	// Sections are written in the same order they were laid out, padding up to each offset
+	for (size_t i = 0; i < deck.size(); i++)
+	{
+		const Card &card = deck[i];
+		const DeckCacheEntry &entry = entries[i];
+
+		file.seekp(entry.imageOffset);
+
+		// Deck images are usually sections of a larger image, so they are written row by row
+		for (int row = 0; row < card.image.rows; row++)
+		{
+			file.write((const char *)card.image.ptr(row), card.image.cols * card.image.elemSize());
+		}
+
+		file.seekp(entry.keyPointOffset);
+
+		for (size_t k = 0; k < card.keyPoints.size(); k++)
+		{
+			const KeyPoint &keyPoint = card.keyPoints[k];
+			DeckCacheKeyPoint record = { keyPoint.pt.x, keyPoint.pt.y, keyPoint.size, keyPoint.angle, keyPoint.response, keyPoint.octave, keyPoint.class_id };
+			file.write((const char *)&record, sizeof(record));
+		}
+
+		file.seekp(entry.descriptorOffset);
+
+		for (int row = 0; row < card.descriptors.rows; row++)
+		{
+			file.write((const char *)card.descriptors.ptr(row), card.descriptors.cols * card.descriptors.elemSize());
+		}
+
+		for (size_t level = 0; level < card.pyramid.size(); level++)
+		{
+			const BitPlane &plane = card.pyramid[level];
+			file.seekp(entry.pyramidOffset[level]);
+			file.write((const char *)plane.words.get(), (streamsize)plane.rows * plane.stride * sizeof(uint64_t));
+		}
+	}
+
+	// Pad the last section, so the file size matches the header
+	if ((uint64_t)file.tellp() < header.fileSize)
+	{
+		file.seekp(header.fileSize - 1);
+		file.put('\0');
+	}
+
+	file.close();
+
+	if (file.fail())
+	{
+		remove(tmpFilename.c_str());
+		return false;
+	}
+
+	// Replace the previous index only once the new one is complete
+	remove(filename.c_str());
+	return rename(tmpFilename.c_str(), filename.c_str()) == 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Card.h"
+#include "DetectionMethod.h"
+
+using namespace std;
+
+/*
+ * Pre-processed deck index, stored next to deck.txt and memory-mapped to be used as is.
+ * Rebuilt whenever deck.txt or the deck image changes.
+ */
+
+const uint32_t DECK_CACHE_VERSION = 2;
+
+/* Returns the filename of the deck index for a given method. */
+string getDeckCacheName(DetectionMethod method);
+
+/* Attempts to load a deck index from a folder, filling the pre-processed values of each card in an existing deck.
+ * Returns false (leaving the deck untouched) if the index is missing, outdated or does not match the deck. */
+bool loadDeckCache(const string &path, vector<Card> &deck, DetectionMethod method);
+
+/* Stores the pre-processed values of each card in a deck as an index in a folder. Returns false if the index could not be written. */
+bool saveDeckCache(const string &path, const vector<Card> &deck, DetectionMethod method);
@@ -0,0 +1,113 @@
+#include "DeckIndex.h"
+#include "CardDetection.h"
+
+#include <map>
+#include <mutex>
+#include <thread>
+
+// Features of every thread that has used an index, shared by its copies. Entries of a map never move, so references stay valid
+struct DeckFeatureCache
+{
+	mutex lock;
+	map<thread::id, DeckFeatures> features;
+};
+
+// A single FLANN index over the whole deck. Binary (ORB) descriptors are hashed by multi-probe LSH and compared by Hamming distance
+static Ptr<FlannBasedMatcher> createMatcher(const DeckIndex &index)
+{
+	Ptr<FlannBasedMatcher> matcher;
+
+	if (index.method == Orb)
+	{
+		matcher = Ptr<FlannBasedMatcher>(new FlannBasedMatcher(new flann::LshIndexParams(ORB_LSH_TABLES, ORB_LSH_KEY_SIZE, ORB_LSH_PROBES)));
+	}
+	else
+	{
+		matcher = Ptr<FlannBasedMatcher>(new FlannBasedMatcher());
+	}
+
+	if (!index.featureDescriptors.empty())
+	{
+		matcher->add(vector<Mat>(1, index.featureDescriptors));
+		matcher->train();
+	}
+
+	return matcher;
+}
+
+DeckIndex buildDeckIndex(const vector<Card> &deck, DetectionMethod method)
+{
+	DeckIndex index;
+
+	index.method = method;
+	index.binaryCoarseWords = 0;
+
+	// Binary decks carry their pyramids, packed here in a single contiguous matrix
+	if (!deck.empty() && !deck[0].pyramid.empty())
+	{
+		const BitPlane &first = deck[0].pyramid[0];
+
+		index.binaryCoarseWords = first.rows * first.stride;
+
+		for (size_t i = 0; i < deck.size(); i++)
+		{
+			const uint64_t *words = deck[i].pyramid[0].words.get();
+			index.binaryCoarse.insert(index.binaryCoarse.end(), words, words + index.binaryCoarseWords);
+		}
+	}
+
+	if (method == Corner)
+	{
+		for (size_t i = 0; i < deck.size(); i++)
+		{
+			index.cornerSignatures.push_back(getCornerSignature(deck[i].image));
+		}
+	}
+
+	if (!isFeatureMethod(method))
+	{
+		return index;
+	}
+
+	// Stack every descriptor in the deck, tagging each row with its card and keypoint
+	for (size_t i = 0; i < deck.size(); i++)
+	{
+		if (deck[i].descriptors.empty())
+		{
+			continue;
+		}
+
+		index.featureDescriptors.push_back(deck[i].descriptors);
+
+		for (int k = 0; k < deck[i].descriptors.rows; k++)
+		{
+			index.featureCardIds.push_back(i);
+			index.featureKeyPointIds.push_back(k);
+		}
+	}
+
+	// The building thread trains its matcher right away, other threads on their first query
+	index.featureCache = make_shared<DeckFeatureCache>();
+	getDeckFeatures(index);
+
+	return index;
+}
+
+DeckFeatures &getDeckFeatures(const DeckIndex &index)
+{
+	DeckFeatureCache &cache = *index.featureCache;
+	lock_guard<mutex> guard(cache.lock);
+	map<thread::id, DeckFeatures>::iterator it = cache.features.find(this_thread::get_id());
+
+	if (it != cache.features.end())
+	{
+		return it->second;
+	}
+
+	DeckFeatures &features = cache.features[this_thread::get_id()];
+
+	createFeatures(index.method, features.detector, features.extractor);
+	features.matcher = createMatcher(index);
+
+	return features;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "OpenCV.h"
+
+#include <iostream>
+#include <vector>
+#include <memory>
+
+#include "Card.h"
+#include "CornerSignature.h"
+#include "DetectionMethod.h"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Deck-wide search structures, built once after the deck is loaded and shared by every detection.
+ */
+
+/* Keypoint detector, descriptor extractor and trained matcher of a feature based method, used by a single thread. */
+struct DeckFeatures
+{
+	Ptr<FeatureDetector> detector;
+	Ptr<DescriptorExtractor> extractor;
+	Ptr<FlannBasedMatcher> matcher;
+};
+
+struct DeckFeatureCache;
+
+struct DeckIndex
+{
+	DetectionMethod method;
+
+	// SURF / ORB: descriptors of all cards stacked in a single matrix, and the card / keypoint each row belongs to
+	Mat featureDescriptors;
+	vector<int> featureCardIds;
+	vector<int> featureKeyPointIds;
+
+	// SURF / ORB: detectors and matchers keep state across calls, so each thread gets its own (see getDeckFeatures)
+	shared_ptr<DeckFeatureCache> featureCache;
+
+	// Binary / Corner: level 0 of the pyramid of every card, one row of binaryCoarseWords words per card in deck order.
+	// A few KB for the whole deck, so a batch of cards is ranked against it while it stays in cache (see rankBinaryDeck)
+	vector<uint64_t> binaryCoarse;
+	int binaryCoarseWords;
+
+	// Corner: signature of each card, in deck order. The deck is small enough for a linear scan to beat any tree
+	vector<CornerSignature> cornerSignatures;
+};
+
+/* Builds the deck-wide search structures required by a given method. */
+DeckIndex buildDeckIndex(const vector<Card> &deck, DetectionMethod method);
+
+/* Returns the features of the calling thread for a feature based index, created (and the matcher trained) on its first call. */
+DeckFeatures &getDeckFeatures(const DeckIndex &index);
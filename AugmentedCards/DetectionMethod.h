@@ -8,5 +8,13 @@ using namespace std;
 enum DetectionMethod
 {
 	Binary,
-	Surf
-};
\ No newline at end of file
+	Surf,
+	Corner,
+	Orb
+};
+
+/* Whether a method matches keypoint descriptors of colour images (SURF, ORB), rather than black and white images. */
+inline bool isFeatureMethod(DetectionMethod method)
+{
+	return method == Surf || method == Orb;
+}
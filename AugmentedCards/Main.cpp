@@ -1,14 +1,51 @@
 #include <iostream>
 #include "CardDetection.h"
 #include "SimpleGame.h"
+#include "ThreadPool.h"
+#include "CardTracker.h"
+#include "BatchProcessing.h"
+#include "Profiler.h"
+#include "VideoPipeline.h"
 
 using namespace std;
 
-const int GAME_CARDS = 4;
-
 const string BASE_ASSETS_PATH = "../Assets/";
 const string BASE_DECK_PATH = BASE_ASSETS_PATH + "deck/";
 
+/* Command line options. */
+struct Options
+{
+	int threads;
+	bool hasMethod;
+	DetectionMethod method;
+	string video;
+	bool display;
+	bool async;
+	FrameDropPolicy dropPolicy;
+	bool allCards;
+	bool cascade;
+	int cacheTtl;
+	string batch;
+	string output;
+	BatchFormat format;
+	bool profile;
+	string trace;
+};
+
+/* Slow method of a cascade (see identifyCardsCascade), with its own deck and index, loaded when requested in the command line options. */
+struct Cascade
+{
+	vector<Card> deck;
+	DeckIndex index;
+	DetectionMethod method;
+};
+
+/* Parses the command line options. Unknown options are reported and ignored. */
+Options parseOptions(int argc, char** argv);
+
+/* Prints the profiling summary and writes the trace, as requested in the command line options. */
+void reportProfile(const Options &options);
+
 /* Displays the initial menu. */
 void displayIntro();
 
@@ -19,44 +56,143 @@ int parseDetectionMode();
 DetectionMethod parseDetectionMethod();
 
 /* Returns an image requested by the user. */
-Mat parseImage(string display);
+Mat parseImage(const string &display);
 
 /* Attempts to detect cards in a given image. */
-void detectInImage(vector<Card> deck, DetectionMethod method);
+void detectInImage(const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards, const Cascade *cascade);
+
+/* Detects cards continuously using a camera, in the background of the preview (see VideoPipeline.h).
+ * Cards that did not move keep their identity for up to cacheTtl detections (see RecognitionCache.h). */
+void detectInVideo(const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards, const Cascade *cascade,
+	FrameDropPolicy policy, int cacheTtl);
 
-/* Attempts to detect cards using a camera. */
-void detectInVideo(vector<Card> deck, DetectionMethod method);
+/* Detects cards continuously in a video (camera or file), tracking them between detections. Reports the frame rate at the end.
+ * Tracking already skips matching between keyframes, so no recognition cache is used. */
+void trackInVideo(VideoCapture &cap, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards,
+	const Cascade *cascade, bool display);
+
+/* Prints the hits and misses of a recognition cache. */
+void reportCache(const RecognitionCache &cache);
 
 /* Attemps to detect cards in a given frame. Draws the results for a simple game. */
-void detectCards(Mat image, vector<Card> deck, DetectionMethod method);
+void detectCards(Mat &image, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards, const Cascade *cascade);
+
+/* Attempts to find the cards of a game in a given frame (every card if allCards is set). Returns an empty move if not enough were found.
+ * A cache skips the cards that did not move in a video, a cascade matches again those the method is unsure about (without the cache). */
+vector<Card> findCards(const Mat &image, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards,
+	RecognitionCache *cache = NULL, const Cascade *cascade = NULL);
+
+/* Evaluates a move for a simple game and draws the result in a frame. */
+void drawGame(Mat &image, const vector<Card> &move);
 
 int main(int argc, char** argv)
 {
-	displayIntro();
+	Options options = parseOptions(argc, argv);
+	setThreadCount(options.threads);
+	setProfiling(options.profile || !options.trace.empty(), !options.trace.empty());
+
+	// Batch jobs never prompt nor display anything, the method defaults to binary
+	if (!options.batch.empty())
+	{
+		DetectionMethod batchMethod = options.hasMethod ? options.method : Binary;
+		vector<string> images = listBatchImages(options.batch);
 
-	int detectionMode = parseDetectionMode();
-	DetectionMethod detectionMethod = parseDetectionMethod();
+		if (images.empty())
+		{
+			cout << "No images found in " << options.batch << endl;
+			return -1;
+		}
+
+		if (options.cascade)
+		{
+			cout << "Ignoring --cascade, batch jobs run a single method." << endl;
+		}
+
+		vector<Card> deck = readDeckList(BASE_DECK_PATH);
+		readDeckImage(BASE_DECK_PATH, deck, batchMethod);
+		DeckIndex index = buildDeckIndex(deck, batchMethod);
+
+		runBatch(images, options.output, options.format, deck, index, batchMethod, options.allCards);
+		reportProfile(options);
+		return 0;
+	}
+
+	// A video file goes straight to continuous mode, so it can run without a camera or the menu
+	bool interactive = options.video.empty();
+	int detectionMode = 3;
+
+	if (interactive)
+	{
+		displayIntro();
+		detectionMode = parseDetectionMode();
+	}
+
+	DetectionMethod detectionMethod = options.hasMethod ? options.method : parseDetectionMethod();
+	VideoCapture cap;
 
 	vector<Card> deck;
 	deck = readDeckList(BASE_DECK_PATH);
 	readDeckImage(BASE_DECK_PATH, deck, detectionMethod);
+	DeckIndex index = buildDeckIndex(deck, detectionMethod);
+
+	// The slow method of a cascade reads its own deck image, for the same deck list
+	Cascade cascade;
+	const Cascade *fallback = NULL;
+
+	if (options.cascade)
+	{
+		cascade.method = CASCADE_FALLBACK;
+		cascade.deck = readDeckList(BASE_DECK_PATH);
+		readDeckImage(BASE_DECK_PATH, cascade.deck, cascade.method);
+		cascade.index = buildDeckIndex(cascade.deck, cascade.method);
+		fallback = &cascade;
+	}
 
 	switch (detectionMode)
 	{
 	case 1:
-		detectInImage(deck, detectionMethod);
+		detectInImage(deck, index, detectionMethod, options.allCards, fallback);
 		break;
 	case 2:
-		detectInVideo(deck, detectionMethod);
+		detectInVideo(deck, index, detectionMethod, options.allCards, fallback, options.dropPolicy, options.cacheTtl);
+		break;
+	case 3:
+		if (interactive)
+		{
+			cap.open(0);
+		}
+		else
+		{
+			cap.open(options.video);
+		}
+
+		// Video files are read at their own frame rate, as if they were a camera
+		if (options.async)
+		{
+			RecognitionCache cache(options.cacheTtl);
+
+			runVideoPipeline(cap, [&](const Mat &frame) { return findCards(frame, deck, index, detectionMethod, options.allCards, &cache, fallback); },
+				drawGame, options.dropPolicy, interactive ? 0 : cap.get(CV_CAP_PROP_FPS), options.display);
+			reportCache(cache);
+		}
+		else
+		{
+			trackInVideo(cap, deck, index, detectionMethod, options.allCards, fallback, options.display);
+		}
 		break;
 	default:
 		break;
 	}
 
-	waitKey(0);
+	if (options.display)
+	{
+		waitKey(0);
+	}
+
+	reportProfile(options);
 }
 
-void detectInImage(vector<Card> deck, DetectionMethod method)
+void detectInImage(const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards, const Cascade *cascade)
 {
 	Mat image = parseImage("Select an image from the assets: ");
 	image = resizeWithLimits(image, 1000, 700);
@@ -64,18 +200,30 @@ void detectInImage(vector<Card> deck, DetectionMethod method)
 	namedWindow("Image", WINDOW_AUTOSIZE);
 	imshow("Image", image);
 
-	detectCards(image, deck, method);
+	detectCards(image, deck, index, method, allCards, cascade);
 }
 
-void detectInVideo(vector<Card> deck, DetectionMethod method)
+void detectInVideo(const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards, const Cascade *cascade,
+	FrameDropPolicy policy, int cacheTtl)
+{
+	VideoCapture cap = VideoCapture(0);
+	RecognitionCache cache(cacheTtl);
+
+	runVideoPipeline(cap, [&](const Mat &frame) { return findCards(frame, deck, index, method, allCards, &cache, cascade); }, drawGame, policy, 0,
+		true);
+	reportCache(cache);
+}
+
+void trackInVideo(VideoCapture &cap, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards,
+	const Cascade *cascade, bool display)
 {
 	int keyPressed = 0;
-	int captureKey = 13;
 	int escapeKey = 27;
+	int frames = 0;
+	int detections = 0;
 
-	VideoCapture cap = VideoCapture(0);
+	CardTracker tracker;
 	Mat frame;
-	namedWindow("Camera", WINDOW_AUTOSIZE);
 
 	if (!cap.isOpened())
 	{
@@ -83,63 +231,235 @@ void detectInVideo(vector<Card> deck, DetectionMethod method)
 		return;
 	}
 
-	cout << endl << "Press ENTER to capture a frame, and ESC to exit at any time." << endl;
+	if (display)
+	{
+		namedWindow("Tracking", WINDOW_AUTOSIZE);
+		cout << endl << "Press ESC to exit at any time." << endl;
+	}
 
-	while (cap.isOpened() && keyPressed != escapeKey)
+	int64 start = getTickCount();
+
+	while (keyPressed != escapeKey && cap.read(frame))
 	{
-		keyPressed = waitKey(1);
+		PROFILE_SCOPE("frame");
 
-		if (!cap.read(frame))
+		// Cards are only identified on keyframes, other frames just follow them
+		if (!tracker.update(frame))
 		{
-			cout << "Skipped a frame..." << endl;
+			tracker.reset(frame, findCards(frame, deck, index, method, allCards, NULL, cascade));
+			detections++;
 		}
 
-		if (keyPressed == captureKey)
+		if (!tracker.getCards().empty())
 		{
-			detectCards(frame, deck, method);
+			drawGame(frame, tracker.getCards());
 		}
 
-		imshow("Camera", frame);
+		frames++;
+
+		if (display)
+		{
+			imshow("Tracking", frame);
+			keyPressed = waitKey(1);
+		}
 	}
+
+	double seconds = (getTickCount() - start) / getTickFrequency();
+	cout << endl << frames << " frames in " << seconds << "s (" << frames / seconds << " fps), " << detections << " detections." << endl;
 }
 
-void detectCards(Mat image, vector<Card> deck, DetectionMethod method)
+void reportCache(const RecognitionCache &cache)
 {
-	vector<Card> move;
-	vector<vector<Point>> contours;
+	// Nothing was looked up, e.g. with a cascade
+	if (cache.getHits() + cache.getMisses() == 0)
+	{
+		return;
+	}
 
-	// Get image contours
-	contours = getContours(image);
+	cout << "Recognition cache: " << cache.getHits() << " hits, " << cache.getMisses() << " misses (" << 100 * cache.getHitRate()
+		<< "% of cards not matched again)." << endl;
+}
 
-	if ((int)contours.size() < GAME_CARDS)
+void detectCards(Mat &image, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards, const Cascade *cascade)
+{
+	vector<Card> move = findCards(image, deck, index, method, allCards, NULL, cascade);
+
+	if (move.empty())
 	{
 		cout << endl << "Couldn't detect the number of cards required to play the game!";
 		return;
 	}
 
-	// Process cards individually
-	for (int i = 0; i < GAME_CARDS; i++)
+	for (size_t i = 0; i < move.size(); i++)
+	{
+		cout << endl << "Matched with " << move[i].symbol << " | " << move[i].suit << endl;
+	}
+
+	// Draw final result
+	drawGame(image, move);
+
+	namedWindow("Detection", WINDOW_AUTOSIZE);
+	imshow("Detection", image);
+}
+
+vector<Card> findCards(const Mat &image, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards,
+	RecognitionCache *cache, const Cascade *cascade)
+{
+	vector<Card> cards;
+
+	if (allCards)
+	{
+		cards = findCardCandidates(image);
+	}
+	else
 	{
-		Rectangle rectangle = getCardRectangleByEquation(contours[i]);
-		Mat perspective = getCardPerspective(image, rectangle, method);
-		Card card = detectCard(perspective, deck, method);
+		// Get image contours, anything that does not look like a card is skipped before matching
+		vector<vector<Point>> contours = getContours(image);
+		cards = locateCards(image, contours, GAME_CARDS);
 
-		card.contours = contours[i];
-		card.rectangle = rectangle;
-		move.push_back(card);
+		if ((int)cards.size() < GAME_CARDS)
+		{
+			return vector<Card>();
+		}
+	}
 
-		cout << endl << "Matched with " << card.symbol << " | " << card.suit << endl;
+	if (cascade != NULL)
+	{
+		identifyCardsCascade(image, cards, deck, index, method, cascade->deck, cascade->index, cascade->method);
+	}
+	else if (cache != NULL)
+	{
+		identifyCards(image, cards, deck, index, method, *cache);
+	}
+	else
+	{
+		identifyCards(image, cards, deck, index, method);
 	}
 
+	return cards;
+}
+
+
+void drawGame(Mat &image, const vector<Card> &move)
+{
 	// Evalute move
 	SimpleGame game;
 	vector<int> winners = game.evaluateGame(move);
 
-	// Draw final result
-	Mat detection = drawCards(image, move, winners);
+	drawCards(image, move, winners);
+}
 
-	namedWindow("Detection", WINDOW_AUTOSIZE);
-	imshow("Detection", image);
+Options parseOptions(int argc, char** argv)
+{
+	Options options;
+	options.threads = (int)thread::hardware_concurrency();
+	options.hasMethod = false;
+	options.method = Binary;
+	options.display = true;
+	options.allCards = false;
+	options.cascade = false;
+	options.cacheTtl = RECOGNITION_CACHE_TTL;
+	options.async = false;
+	options.dropPolicy = DropOldest;
+	options.output = BASE_ASSETS_PATH + "batch";
+	options.format = Json;
+	options.profile = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--threads" && i + 1 < argc)
+		{
+			options.threads = max(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--method" && i + 1 < argc)
+		{
+			string method = argv[++i];
+			options.hasMethod = method == "binary" || method == "surf" || method == "corner" || method == "orb";
+			options.method = method == "surf" ? Surf : method == "corner" ? Corner : method == "orb" ? Orb : Binary;
+		}
+		else if (arg == "--video" && i + 1 < argc)
+		{
+			options.video = argv[++i];
+		}
+		else if (arg == "--no-display")
+		{
+			options.display = false;
+		}
+		else if (arg == "--async")
+		{
+			options.async = true;
+		}
+		else if (arg == "--drop-policy" && i + 1 < argc)
+		{
+			string policy = argv[++i];
+
+			if (!parseFrameDropPolicy(policy, options.dropPolicy))
+			{
+				cout << "Ignoring unknown drop policy: " << policy << endl;
+			}
+		}
+		else if (arg == "--all-cards")
+		{
+			options.allCards = true;
+		}
+		else if (arg == "--cascade")
+		{
+			options.cascade = true;
+		}
+		else if (arg == "--cache-ttl" && i + 1 < argc)
+		{
+			options.cacheTtl = max(atoi(argv[++i]), 0);
+		}
+		else if (arg == "--batch" && i + 1 < argc)
+		{
+			options.batch = argv[++i];
+		}
+		else if (arg == "--output" && i + 1 < argc)
+		{
+			options.output = argv[++i];
+		}
+		else if (arg == "--profile")
+		{
+			options.profile = true;
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			options.trace = argv[++i];
+		}
+		else if (arg == "--format" && i + 1 < argc)
+		{
+			string format = argv[++i];
+			options.format = format == "csv" ? Csv : Json;
+		}
+		else
+		{
+			cout << "Ignoring unknown option: " << arg << endl;
+		}
+	}
+
+	return options;
+}
+
+void reportProfile(const Options &options)
+{
+	if (options.profile)
+	{
+		printProfileSummary(cout);
+	}
+
+	if (!options.trace.empty())
+	{
+		if (writeProfileTrace(options.trace))
+		{
+			cout << endl << "Trace written to " << options.trace << endl;
+		}
+		else
+		{
+			cout << endl << "Could not write the trace to " << options.trace << endl;
+		}
+	}
 }
 
 int parseDetectionMode()
@@ -150,7 +470,8 @@ int parseDetectionMode()
 	{
 		cout << "Select a detection mode: " << endl << endl;
 		cout << "1 - Image" << endl;
-		cout << "2 - Camera" << endl << endl;
+		cout << "2 - Camera (detection in the background)" << endl;
+		cout << "3 - Camera (continuous, with tracking)" << endl << endl;
 		cout << "> ";
 		cin >> choice;
 
@@ -160,7 +481,7 @@ int parseDetectionMode()
 			cin.ignore(numeric_limits<streamsize>::max(), '\n');
 			cout << endl << "Not a number! ";
 		}
-		else if (choice <= 0 || choice > 2)
+		else if (choice <= 0 || choice > 3)
 		{
 			cin.clear();
 			cin.ignore(numeric_limits<streamsize>::max(), '\n');
@@ -186,7 +507,9 @@ DetectionMethod parseDetectionMethod()
 	{
 		cout << "Select a detection method: " << endl << endl;
 		cout << "1 - Binary (fast)" << endl;
-		cout << "2 - SURF (slower, better results)" << endl << endl;
+		cout << "2 - SURF (slower, better results)" << endl;
+		cout << "3 - Corner (fastest, reads the rank and suit in the corners)" << endl;
+		cout << "4 - ORB (like SURF, with binary descriptors)" << endl << endl;
 		cout << "> ";
 		cin >> choice;
 
@@ -196,7 +519,7 @@ DetectionMethod parseDetectionMethod()
 			cin.ignore(numeric_limits<streamsize>::max(), '\n');
 			cout << endl << "Not a number! ";
 		}
-		else if (choice <= 0 || choice > 2)
+		else if (choice <= 0 || choice > 4)
 		{
 			cin.clear();
 			cin.ignore(numeric_limits<streamsize>::max(), '\n');
@@ -208,10 +531,18 @@ DetectionMethod parseDetectionMethod()
 			{
 				method = Binary;
 			}
-			else
+			else if (choice == 2)
 			{
 				method = Surf;
 			}
+			else if (choice == 3)
+			{
+				method = Corner;
+			}
+			else
+			{
+				method = Orb;
+			}
 
 			break;
 		}
@@ -220,7 +551,7 @@ DetectionMethod parseDetectionMethod()
 	return method;
 }
 
-Mat parseImage(string display)
+Mat parseImage(const string &display)
 {
 	string filename;
 	Mat image;
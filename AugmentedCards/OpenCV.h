@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Every OpenCV header used by the project, for OpenCV 2.4 (Visual Studio solution) as well as OpenCV 3 and 4 (CMake build).
+ * HAVE_SURF is only defined when SURF is available (nonfree in 2.4, xfeatures2d in opencv_contrib afterwards).
+ */
+
+#include <opencv2/core/version.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/features2d/features2d.hpp>
+#include <opencv2/flann/flann.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#if CV_MAJOR_VERSION >= 3
+#include <opencv2/opencv_modules.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+
+#ifdef HAVE_OPENCV_XFEATURES2D
+#include <opencv2/xfeatures2d.hpp>
+#define HAVE_SURF
+#endif
+
+// Constants of the C API, no longer declared by the C++ headers
+#ifndef CV_AA
+#define CV_AA cv::LINE_AA
+#endif
+
+#ifndef CV_CAP_PROP_FPS
+#define CV_CAP_PROP_FPS cv::CAP_PROP_FPS
+#endif
+#else
+#include <opencv2/nonfree/nonfree.hpp>
+#include <opencv2/nonfree/features2d.hpp>
+#define HAVE_SURF
+#endif
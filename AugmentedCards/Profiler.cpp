@@ -0,0 +1,250 @@
+#include "Profiler.h"
+
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+// Histogram buckets: exact below 16ns, then 16 buckets per power of two
+static const int PROFILE_SUB_BUCKETS = 16;
+static const int PROFILE_BUCKETS = 61 * PROFILE_SUB_BUCKETS;
+
+/* Aggregated times of a timer, in nanoseconds. */
+struct ProfileTimer
+{
+	int64_t count, total, max;
+	vector<int64_t> buckets;
+
+	ProfileTimer() : count(0), total(0), max(0), buckets(PROFILE_BUCKETS, 0)
+	{
+	}
+};
+
+/* A single timed section, kept for the trace. */
+struct TraceEvent
+{
+	const char *name;
+	int64_t start, duration;
+};
+
+/* Everything recorded by one thread. Only that thread writes to it, the lock just guards reads from reports. */
+struct ProfileBuffer
+{
+	mutex lock;
+	int threadId;
+	unordered_map<const char *, ProfileTimer> timers;
+	unordered_map<const char *, int64_t> counters;
+	vector<TraceEvent> events;
+};
+
+atomic<bool> profilingEnabled(false);
+static atomic<bool> tracingEnabled(false);
+static const chrono::steady_clock::time_point profileEpoch = chrono::steady_clock::now();
+
+static mutex buffersLock;
+static vector<shared_ptr<ProfileBuffer>> buffers;
+
+static ProfileBuffer &getThreadBuffer()
+{
+	// Buffers are kept by the registry as well, so they outlive the threads that recorded them
+	static thread_local shared_ptr<ProfileBuffer> buffer;
+
+	if (!buffer)
+	{
+		buffer = make_shared<ProfileBuffer>();
+
+		lock_guard<mutex> guard(buffersLock);
+		buffer->threadId = (int)buffers.size();
+		buffers.push_back(buffer);
+	}
+
+	return *buffer;
+}
+
+static int getBucket(int64_t value)
+{
+	if (value < PROFILE_SUB_BUCKETS)
+	{
+		return (int)max(value, (int64_t)0);
+	}
+
+	int exponent = 4;
+
+	while (value >> (exponent + 1))
+	{
+		exponent++;
+	}
+
+	int sub = (int)((value >> (exponent - 4)) & (PROFILE_SUB_BUCKETS - 1));
+	return (exponent - 3) * PROFILE_SUB_BUCKETS + sub;
+}
+
+static double getBucketValue(int bucket)
+{
+	if (bucket < PROFILE_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+
+	int exponent = bucket / PROFILE_SUB_BUCKETS + 3;
+	int sub = bucket % PROFILE_SUB_BUCKETS;
+	double width = (double)(1LL << (exponent - 4));
+
+	// Middle of the bucket
+	return (PROFILE_SUB_BUCKETS + sub) * width + width / 2;
+}
+
+static double getPercentile(const ProfileTimer &timer, double percentile)
+{
+	int64_t rank = max((int64_t)(percentile * timer.count + 0.5), (int64_t)1);
+	int64_t seen = 0;
+
+	for (int i = 0; i < PROFILE_BUCKETS; i++)
+	{
+		seen += timer.buckets[i];
+
+		if (seen >= rank)
+		{
+			return min(getBucketValue(i), (double)timer.max);
+		}
+	}
+
+	return (double)timer.max;
+}
+
+void setProfiling(bool enabled, bool trace)
+{
+	tracingEnabled = enabled && trace;
+	profilingEnabled = enabled;
+}
+
+int64_t getProfileTime()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - profileEpoch).count();
+}
+
+void addProfileTime(const char *name, int64_t start, int64_t end)
+{
+	ProfileBuffer &buffer = getThreadBuffer();
+	int64_t duration = end - start;
+
+	lock_guard<mutex> guard(buffer.lock);
+	ProfileTimer &timer = buffer.timers[name];
+
+	timer.count++;
+	timer.total += duration;
+	timer.max = max(timer.max, duration);
+	timer.buckets[getBucket(duration)]++;
+
+	if (tracingEnabled.load(memory_order_relaxed) && buffer.events.size() < PROFILE_MAX_TRACE_EVENTS)
+	{
+		TraceEvent event = { name, start, duration };
+		buffer.events.push_back(event);
+	}
+}
+
+void addProfileCount(const char *name, int64_t value)
+{
+	ProfileBuffer &buffer = getThreadBuffer();
+
+	lock_guard<mutex> guard(buffer.lock);
+	buffer.counters[name] += value;
+}
+
+void printProfileSummary(ostream &stream)
+{
+	map<string, ProfileTimer> timers;
+	map<string, int64_t> counters;
+
+	// The same name may be recorded by several threads (and even be a different literal in each file)
+	lock_guard<mutex> registryGuard(buffersLock);
+
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		lock_guard<mutex> guard(buffers[i]->lock);
+
+		for (auto it = buffers[i]->timers.begin(); it != buffers[i]->timers.end(); it++)
+		{
+			ProfileTimer &timer = timers[it->first];
+			timer.count += it->second.count;
+			timer.total += it->second.total;
+			timer.max = max(timer.max, it->second.max);
+
+			for (int j = 0; j < PROFILE_BUCKETS; j++)
+			{
+				timer.buckets[j] += it->second.buckets[j];
+			}
+		}
+
+		for (auto it = buffers[i]->counters.begin(); it != buffers[i]->counters.end(); it++)
+		{
+			counters[it->first] += it->second;
+		}
+	}
+
+	stream << endl << left << setw(28) << "Timer (ms)" << right << setw(10) << "count" << setw(12) << "total" << setw(10) << "mean"
+		<< setw(10) << "p50" << setw(10) << "p95" << setw(10) << "p99" << setw(10) << "max" << endl;
+	streamsize precision = stream.precision();
+	stream << fixed << setprecision(3);
+
+	for (auto it = timers.begin(); it != timers.end(); it++)
+	{
+		const ProfileTimer &timer = it->second;
+
+		stream << left << setw(28) << it->first << right << setw(10) << timer.count
+			<< setw(12) << timer.total / 1e6 << setw(10) << timer.total / 1e6 / timer.count
+			<< setw(10) << getPercentile(timer, 0.50) / 1e6 << setw(10) << getPercentile(timer, 0.95) / 1e6
+			<< setw(10) << getPercentile(timer, 0.99) / 1e6 << setw(10) << timer.max / 1e6 << endl;
+	}
+
+	if (!counters.empty())
+	{
+		stream << endl << left << setw(28) << "Counter" << right << setw(10) << "value" << endl;
+
+		for (auto it = counters.begin(); it != counters.end(); it++)
+		{
+			stream << left << setw(28) << it->first << right << setw(10) << it->second << endl;
+		}
+	}
+
+	stream.unsetf(ios::floatfield);
+	stream.precision(precision);
+}
+
+bool writeProfileTrace(const string &filename)
+{
+	ofstream file(filename);
+
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	// Complete ("X") events, timestamps in microseconds
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	file << fixed << setprecision(3);
+
+	bool first = true;
+	lock_guard<mutex> registryGuard(buffersLock);
+
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		lock_guard<mutex> guard(buffers[i]->lock);
+		const vector<TraceEvent> &events = buffers[i]->events;
+
+		for (size_t j = 0; j < events.size(); j++)
+		{
+			file << (first ? "\n" : ",\n") << "{\"name\":\"" << events[j].name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffers[i]->threadId
+				<< ",\"ts\":" << events[j].start / 1e3 << ",\"dur\":" << events[j].duration / 1e3 << "}";
+			first = false;
+		}
+	}
+
+	file << "\n]}" << endl;
+	return file.good();
+}
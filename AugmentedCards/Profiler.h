@@ -0,0 +1,73 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+/*
+ * Scoped timers and counters for the detection pipeline, aggregated into histograms or kept as trace events (chrome://tracing).
+ * Disabled by default at the cost of a flag check per timer, removed entirely by defining DISABLE_PROFILING.
+ */
+
+/* Upper limit of trace events kept per thread, so long runs do not grow without bounds. */
+const size_t PROFILE_MAX_TRACE_EVENTS = 1000000;
+
+extern atomic<bool> profilingEnabled;
+
+/* Enables or disables profiling. Trace events are only kept if trace is also set. */
+void setProfiling(bool enabled, bool trace);
+
+/* Returns whether timers and counters are being recorded. */
+inline bool isProfiling()
+{
+	return profilingEnabled.load(memory_order_relaxed);
+}
+
+/* Returns the time elapsed since the profiler started, in nanoseconds. */
+int64_t getProfileTime();
+
+/* Records a timed section, from start to end (see getProfileTime). */
+void addProfileTime(const char *name, int64_t start, int64_t end);
+
+/* Records the time spent in a scope, from its construction until its destruction. */
+class ScopedTimer
+{
+private:
+	const char *name;
+	int64_t start;
+
+public:
+	ScopedTimer(const char *name) : name(name), start(isProfiling() ? getProfileTime() : -1)
+	{
+	}
+
+	~ScopedTimer()
+	{
+		if (start >= 0)
+		{
+			addProfileTime(name, start, getProfileTime());
+		}
+	}
+};
+
+/* Adds a value to a counter. */
+void addProfileCount(const char *name, int64_t value);
+
+/* Prints the count, total, mean, percentiles (p50, p95, p99) and maximum of every timer, followed by every counter. */
+void printProfileSummary(ostream &stream);
+
+/* Writes every trace event in Chrome's trace event format (JSON). Returns false if the file could not be written. */
+bool writeProfileTrace(const string &filename);
+
+#ifdef DISABLE_PROFILING
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(name, value)
+#else
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(name)
+#define PROFILE_COUNT(name, value) do { if (isProfiling()) addProfileCount(name, value); } while (0)
+#endif
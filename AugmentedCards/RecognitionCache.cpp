@@ -0,0 +1,145 @@
+#include "RecognitionCache.h"
+#include "BitPlane.h"
+#include "Profiler.h"
+
+uint64_t getAppearanceHash(const Mat &image)
+{
+	Mat small, gray;
+
+	// Shrinking first keeps the colour conversion down to a handful of pixels
+	resize(image, small, Size(RECOGNITION_CACHE_HASH_SIZE, RECOGNITION_CACHE_HASH_SIZE), 0, 0, INTER_AREA);
+
+	if (small.channels() > 1)
+	{
+		cvtColor(small, gray, COLOR_BGR2GRAY);
+	}
+	else
+	{
+		gray = small;
+	}
+
+	double mean = cv::mean(gray)[0];
+	uint64_t hash = 0;
+
+	for (int i = 0; i < gray.rows; i++)
+	{
+		const uchar *row = gray.ptr<uchar>(i);
+
+		for (int j = 0; j < gray.cols; j++)
+		{
+			hash = (hash << 1) | (row[j] > mean ? 1 : 0);
+		}
+	}
+
+	return hash;
+}
+
+RecognitionCache::RecognitionCache(int ttl)
+{
+	this->ttl = ttl;
+	detection = 0;
+	hits = misses = 0;
+}
+
+RecognitionCache::~RecognitionCache()
+{
+}
+
+void RecognitionCache::quantize(const Rectangle &rectangle, Point corners[4])
+{
+	const Point *points[4] = { &rectangle.p1, &rectangle.p2, &rectangle.p3, &rectangle.p4 };
+
+	for (int i = 0; i < 4; i++)
+	{
+		corners[i] = Point(cvFloor((double)points[i]->x / RECOGNITION_CACHE_GRID), cvFloor((double)points[i]->y / RECOGNITION_CACHE_GRID));
+	}
+}
+
+int RecognitionCache::lookup(const Rectangle &rectangle, uint64_t hash)
+{
+	Point corners[4];
+	quantize(rectangle, corners);
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		Entry &entry = entries[i];
+		uint64_t hashDiff = hash ^ entry.hash;
+		bool still = true;
+
+		// Every corner has to stay within a cell of where the card was identified, so slow drift eventually invalidates it too
+		for (int k = 0; k < 4 && still; k++)
+		{
+			still = abs(corners[k].x - entry.corners[k].x) <= RECOGNITION_CACHE_MAX_CELLS
+				&& abs(corners[k].y - entry.corners[k].y) <= RECOGNITION_CACHE_MAX_CELLS;
+		}
+
+		if (still && popcount(&hashDiff, 1) <= RECOGNITION_CACHE_MAX_HASH_DIFF)
+		{
+			entry.seenDetection = detection;
+			hits++;
+
+			PROFILE_COUNT("recognition cache hits", 1);
+			return entry.match;
+		}
+	}
+
+	misses++;
+
+	PROFILE_COUNT("recognition cache misses", 1);
+	return -1;
+}
+
+void RecognitionCache::store(const Rectangle &rectangle, uint64_t hash, int match)
+{
+	if (ttl <= 0)
+	{
+		return;
+	}
+
+	Entry entry;
+
+	quantize(rectangle, entry.corners);
+	entry.hash = hash;
+	entry.match = match;
+	entry.identifiedDetection = detection;
+	entry.seenDetection = detection;
+
+	entries.push_back(entry);
+}
+
+void RecognitionCache::nextDetection()
+{
+	size_t kept = 0;
+
+	// A card that was not found where it was has moved (or left), so its entry can no longer be trusted
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].seenDetection == detection && detection + 1 - entries[i].identifiedDetection < ttl)
+		{
+			entries[kept++] = entries[i];
+		}
+	}
+
+	entries.resize(kept);
+	detection++;
+}
+
+void RecognitionCache::clear()
+{
+	entries.clear();
+}
+
+int64_t RecognitionCache::getHits() const
+{
+	return hits;
+}
+
+int64_t RecognitionCache::getMisses() const
+{
+	return misses;
+}
+
+double RecognitionCache::getHitRate() const
+{
+	return hits + misses > 0 ? (double)hits / (hits + misses) : 0;
+}
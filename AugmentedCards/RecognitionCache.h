@@ -0,0 +1,71 @@
+#pragma once
+
+#include "OpenCV.h"
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+#include "Rectangle.h"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Identity of the cards seen in the last detections of a video, recognized by their quantized corners and a 64-bit hash.
+ * Time is counted in detections (see nextDetection), entries expire after a TTL. Not meant to be shared between threads.
+ */
+
+const int RECOGNITION_CACHE_TTL = 30;
+const int RECOGNITION_CACHE_GRID = 8;
+const int RECOGNITION_CACHE_MAX_CELLS = 1;
+const int RECOGNITION_CACHE_HASH_SIZE = 8;
+const int RECOGNITION_CACHE_MAX_HASH_DIFF = 6;
+
+/* Returns the average hash of an image (e.g. the perspective of a card): one bit per cell of an 8x8 grid, set where the cell
+ * is brighter than the mean. Cheap, and stable under noise and small changes in lighting. */
+uint64_t getAppearanceHash(const Mat &image);
+
+class RecognitionCache
+{
+private:
+	struct Entry
+	{
+		Point corners[4];
+		uint64_t hash;
+		int match;
+		int64_t identifiedDetection;
+		int64_t seenDetection;
+	};
+
+	vector<Entry> entries;
+	int ttl;
+	int64_t detection;
+	int64_t hits, misses;
+
+	static void quantize(const Rectangle &rectangle, Point corners[4]);
+
+public:
+	/* Entries are identified again after ttl detections. A ttl of 0 disables the cache, every lookup misses. */
+	RecognitionCache(int ttl = RECOGNITION_CACHE_TTL);
+	~RecognitionCache();
+
+	/* Returns the deck index of a card at (about) the same place and with (about) the same appearance in the previous detection,
+	 * or -1 if there is none. */
+	int lookup(const Rectangle &rectangle, uint64_t hash);
+
+	/* Remembers the identity of a card matched in the current detection. */
+	void store(const Rectangle &rectangle, uint64_t hash, int match);
+
+	/* Ends the current detection: drops the entries of cards not seen in it, and those older than the TTL. */
+	void nextDetection();
+
+	/* Forgets every card, e.g. when the video changes. Counters are kept. */
+	void clear();
+
+	int64_t getHits() const;
+	int64_t getMisses() const;
+
+	/* Returns the fraction of lookups that hit, 0 before the first one. */
+	double getHitRate() const;
+};
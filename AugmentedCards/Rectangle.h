@@ -1,12 +1,6 @@
 #pragma once
 
-#include <opencv\cv.h>
-#include <opencv2\core\core_c.h>
-#include <opencv2\highgui\highgui.hpp>
-#include <opencv2\imgproc\imgproc.hpp>
-#include <opencv2\features2d\features2d.hpp>
-#include <opencv2\nonfree\nonfree.hpp>
-#include <opencv2\nonfree\features2d.hpp>
+#include "OpenCV.h"
 
 #include <iostream>
 #include <vector>
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+
+using namespace std;
+
+/*
+ * Fixed capacity lock-free ring buffer for one producer thread and one consumer thread.
+ * Neither side waits: a push fails when the buffer is full and a pop when it is empty.
+ */
+template <typename T>
+class RingBuffer
+{
+private:
+	// One slot is always left empty, to tell a full buffer from an empty one
+	vector<T> slots;
+	atomic<size_t> head, tail;
+
+public:
+	RingBuffer(size_t capacity) : slots((capacity > 0 ? capacity : 1) + 1), head(0), tail(0)
+	{
+	}
+
+	/* Adds an item (producer only). Returns false, leaving the item untouched, if the buffer is full. */
+	bool push(T &item)
+	{
+		size_t current = tail.load(memory_order_relaxed);
+		size_t next = (current + 1) % slots.size();
+
+		if (next == head.load(memory_order_acquire))
+		{
+			return false;
+		}
+
+		slots[current] = std::move(item);
+		tail.store(next, memory_order_release);
+
+		return true;
+	}
+
+	/* Removes the oldest item (consumer only). Returns false if the buffer is empty. */
+	bool pop(T &item)
+	{
+		size_t current = head.load(memory_order_relaxed);
+
+		if (current == tail.load(memory_order_acquire))
+		{
+			return false;
+		}
+
+		item = std::move(slots[current]);
+		head.store((current + 1) % slots.size(), memory_order_release);
+
+		return true;
+	}
+
+	/* Returns whether the buffer is empty. Exact for the consumer, a hint for anyone else. */
+	bool empty()
+	{
+		return head.load(memory_order_acquire) == tail.load(memory_order_acquire);
+	}
+};
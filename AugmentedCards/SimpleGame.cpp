@@ -1,4 +1,5 @@
 #include "SimpleGame.h"
+#include "Profiler.h"
 
 
 SimpleGame::SimpleGame()
@@ -10,7 +11,7 @@ SimpleGame::~SimpleGame()
 {
 }
 
-int SimpleGame::getCardValue(Card card)
+int SimpleGame::getCardValue(const Card &card)
 {
 	if (card.isNumber) 
 	{
@@ -36,8 +37,10 @@ int SimpleGame::getCardValue(Card card)
 	return 0;
 }
 
-vector<int> SimpleGame::evaluateGame(vector<Card> move)
+vector<int> SimpleGame::evaluateGame(const vector<Card> &move)
 {
+	PROFILE_SCOPE("evaluateGame");
+
 	vector<int> winners;
 	int bestVal = 0;
 	int bestCard = 0;
@@ -7,17 +7,20 @@
 
 using namespace std;
 
+/* Number of cards played in each move. */
+const int GAME_CARDS = 4;
+
 /*
  * Simple game implementation. Highest value, regardless of suit, wins.
  */
 class SimpleGame : public CardGame
 {
 private:
-	virtual int getCardValue(Card card);
+	virtual int getCardValue(const Card &card);
 
 public:
 	SimpleGame();
 	~SimpleGame();
-	virtual vector<int> evaluateGame(vector<Card> move);
+	virtual vector<int> evaluateGame(const vector<Card> &move);
 };
 
@@ -0,0 +1,150 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+static unique_ptr<ThreadPool> sharedPool;
+static once_flag sharedPoolCreated;
+
+ThreadPool::ThreadPool(int threads)
+{
+	stopping = false;
+
+	// The caller counts as one of the threads
+	for (int i = 1; i < threads; i++)
+	{
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+
+	available.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+}
+
+int ThreadPool::getThreadCount()
+{
+	return (int)workers.size() + 1;
+}
+
+void ThreadPool::runJob(const shared_ptr<Job> &job)
+{
+	int i;
+
+	// Indices are claimed one at a time, so threads that finish early keep taking work
+	while ((i = job->next++) < job->count)
+	{
+		(*job->task)(i);
+
+		if (++job->done == job->count)
+		{
+			lock_guard<mutex> guard(lock);
+			finished.notify_all();
+		}
+	}
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		shared_ptr<Job> job;
+
+		{
+			unique_lock<mutex> guard(lock);
+			available.wait(guard, [this] { return stopping || !jobs.empty(); });
+
+			if (jobs.empty())
+			{
+				return;
+			}
+
+			job = jobs.front();
+		}
+
+		runJob(job);
+
+		// Every index has been claimed, so the job no longer needs to be offered to other workers
+		lock_guard<mutex> guard(lock);
+
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			if (jobs[i] == job)
+			{
+				jobs.erase(jobs.begin() + i);
+				break;
+			}
+		}
+	}
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int)> &task)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	if (workers.empty() || count == 1)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			task(i);
+		}
+
+		return;
+	}
+
+	shared_ptr<Job> job(new Job());
+	job->task = &task;
+	job->count = count;
+	job->next = 0;
+	job->done = 0;
+
+	{
+		lock_guard<mutex> guard(lock);
+		jobs.push_back(job);
+	}
+
+	available.notify_all();
+	runJob(job);
+
+	// Wait for the indices still being processed by other threads
+	unique_lock<mutex> guard(lock);
+	finished.wait(guard, [&job] { return job->done == job->count; });
+}
+
+void setThreadCount(int threads)
+{
+	// The default pool may already be there, created by a call made before this one. Replacing it is only safe with no detection running
+	call_once(sharedPoolCreated, [] {});
+	sharedPool.reset(new ThreadPool(max(threads, 1)));
+}
+
+ThreadPool &getThreadPool()
+{
+	// Threads detecting at the same time for the first time create the default pool only once
+	call_once(sharedPoolCreated, []
+	{
+		if (!sharedPool)
+		{
+			sharedPool.reset(new ThreadPool((int)thread::hardware_concurrency()));
+		}
+	});
+
+	return *sharedPool;
+}
+
+void parallelFor(int count, const function<void(int)> &task)
+{
+	getThreadPool().parallelFor(count, task);
+}
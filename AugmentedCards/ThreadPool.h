@@ -0,0 +1,58 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+using namespace std;
+
+/*
+ * Fixed pool of worker threads, used to process independent work (cards in a frame, cards in the deck) in parallel.
+ * The calling thread always takes part in its own work, so parallel loops can be nested without deadlocking.
+ */
+class ThreadPool
+{
+private:
+	struct Job
+	{
+		const function<void(int)> *task;
+		int count;
+		atomic<int> next;
+		atomic<int> done;
+	};
+
+	vector<thread> workers;
+	deque<shared_ptr<Job>> jobs;
+	mutex lock;
+	condition_variable available, finished;
+	bool stopping;
+
+	void workerLoop();
+	void runJob(const shared_ptr<Job> &job);
+
+public:
+	ThreadPool(int threads);
+	~ThreadPool();
+
+	/* Returns the number of threads working on a loop, including the caller. */
+	int getThreadCount();
+
+	/* Runs task(i) for every i in [0, count) and waits for all of them. Each index runs exactly once, in no particular order. */
+	void parallelFor(int count, const function<void(int)> &task);
+};
+
+/* Sets the number of threads (including the caller) of the shared pool. A single thread runs everything sequentially.
+ * Replaces the pool, so it must only be called before detection starts (e.g. at startup), never while another thread may be detecting. */
+void setThreadCount(int threads);
+
+/* Returns the shared pool used by the detection pipeline. Defaults to one thread per core, created once on first use by any thread. */
+ThreadPool &getThreadPool();
+
+/* Runs a parallel loop on the shared pool. */
+void parallelFor(int count, const function<void(int)> &task);
@@ -0,0 +1,290 @@
+#include "VideoPipeline.h"
+#include "RingBuffer.h"
+#include "Profiler.h"
+
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+/* A captured frame, timestamped when it was read. */
+struct PipelineFrame
+{
+	Mat image;
+	int64 captureTime;
+};
+
+/* Latest frame offered to the detection stage, and latest result it produced. Older ones are simply overwritten. */
+struct DetectionSlot
+{
+	mutex lock;
+	condition_variable available;
+	PipelineFrame frame;
+	bool hasFrame;
+	bool stopping;
+
+	vector<Card> cards;
+	int64 cardsTime;
+	int detections, skipped;
+};
+
+static double getElapsedTime(int64 start, int64 end)
+{
+	return (end - start) * 1000.0 / getTickFrequency();
+}
+
+static double getPercentile(const vector<double> &sorted, double percentile)
+{
+	size_t rank = min((size_t)(percentile * sorted.size()), sorted.size() - 1);
+	return sorted[rank];
+}
+
+bool parseFrameDropPolicy(const string &name, FrameDropPolicy &policy)
+{
+	if (name == "oldest")
+	{
+		policy = DropOldest;
+	}
+	else if (name == "newest")
+	{
+		policy = DropNewest;
+	}
+	else if (name == "block")
+	{
+		policy = Block;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+void runVideoPipeline(VideoCapture &cap, const function<vector<Card>(const Mat &)> &detect,
+	const function<void(Mat &, const vector<Card> &)> &draw, FrameDropPolicy policy, double sourceFps, bool display)
+{
+	if (!cap.isOpened())
+	{
+		cout << "Unable to start capture!" << endl;
+		return;
+	}
+
+	RingBuffer<PipelineFrame> ring(PIPELINE_RING_SIZE);
+	atomic<bool> stopping(false), captureDone(false);
+	atomic<int> captured(0), droppedAtCapture(0);
+
+	DetectionSlot slot;
+	slot.hasFrame = false;
+	slot.stopping = false;
+	slot.cardsTime = 0;
+	slot.detections = slot.skipped = 0;
+
+	if (display)
+	{
+		namedWindow("Camera", WINDOW_AUTOSIZE);
+		cout << endl << "Press ESC to exit at any time." << endl;
+	}
+
+	// Capture stage, the only producer of the ring buffer
+	thread capture([&]()
+	{
+		chrono::steady_clock::time_point next = chrono::steady_clock::now();
+		chrono::duration<double> period(sourceFps > 0 ? 1.0 / sourceFps : 0);
+
+		while (!stopping)
+		{
+			// Each frame gets its own image, as earlier ones may still be in use by display or detection
+			PipelineFrame frame;
+
+			if (!cap.read(frame.image))
+			{
+				break;
+			}
+
+			frame.captureTime = getTickCount();
+			captured++;
+
+			while (!ring.push(frame))
+			{
+				if (policy != Block || stopping)
+				{
+					droppedAtCapture++;
+					PROFILE_COUNT("pipeline dropped at capture", 1);
+					break;
+				}
+
+				this_thread::sleep_for(chrono::milliseconds(1));
+			}
+
+			if (sourceFps > 0)
+			{
+				next += chrono::duration_cast<chrono::steady_clock::duration>(period);
+				this_thread::sleep_until(next);
+			}
+		}
+
+		captureDone = true;
+	});
+
+	// Detection stage, only ever works on the newest frame it was given
+	thread detection([&]()
+	{
+		unique_lock<mutex> guard(slot.lock);
+
+		while (true)
+		{
+			slot.available.wait(guard, [&] { return slot.stopping || slot.hasFrame; });
+
+			if (!slot.hasFrame)
+			{
+				break;
+			}
+
+			PipelineFrame frame = slot.frame;
+			slot.hasFrame = false;
+			guard.unlock();
+
+			vector<Card> cards = detect(frame.image);
+
+			guard.lock();
+			slot.cards = cards;
+			slot.cardsTime = frame.captureTime;
+			slot.detections++;
+		}
+	});
+
+	// Display stage, on the calling thread (windows belong to the main thread)
+	vector<double> latencies, resultAges;
+	int displayed = 0, droppedAtDisplay = 0;
+	int keyPressed = 0;
+	int escapeKey = 27;
+	PipelineFrame frame;
+	Mat canvas;
+	int64 start = getTickCount();
+
+	while (true)
+	{
+		if (!ring.pop(frame))
+		{
+			if (captureDone && ring.empty())
+			{
+				break;
+			}
+
+			if (display)
+			{
+				keyPressed = waitKey(1);
+			}
+			else
+			{
+				this_thread::sleep_for(chrono::milliseconds(1));
+			}
+
+			if (keyPressed == escapeKey)
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		// Stale frames are skipped, only the newest one is shown
+		if (policy == DropOldest)
+		{
+			while (ring.pop(frame))
+			{
+				droppedAtDisplay++;
+				PROFILE_COUNT("pipeline dropped at display", 1);
+			}
+		}
+
+		vector<Card> cards;
+		int64 cardsTime;
+
+		{
+			lock_guard<mutex> guard(slot.lock);
+
+			// A frame the detection did not get to in time is replaced by this one
+			slot.skipped += slot.hasFrame ? 1 : 0;
+			slot.frame = frame;
+			slot.hasFrame = true;
+
+			cards = slot.cards;
+			cardsTime = slot.cardsTime;
+		}
+
+		slot.available.notify_one();
+
+		// Results are drawn on a copy, detection may still be reading the frame
+		frame.image.copyTo(canvas);
+
+		if (!cards.empty())
+		{
+			draw(canvas, cards);
+		}
+
+		if (display)
+		{
+			imshow("Camera", canvas);
+			keyPressed = waitKey(1);
+		}
+
+		int64 now = getTickCount();
+		latencies.push_back(getElapsedTime(frame.captureTime, now));
+
+		if (cardsTime > 0)
+		{
+			resultAges.push_back(getElapsedTime(cardsTime, now));
+		}
+
+		displayed++;
+
+		if (keyPressed == escapeKey)
+		{
+			break;
+		}
+	}
+
+	stopping = true;
+	capture.join();
+
+	{
+		lock_guard<mutex> guard(slot.lock);
+		slot.stopping = true;
+		slot.hasFrame = false;
+	}
+
+	slot.available.notify_one();
+	detection.join();
+
+	double seconds = getElapsedTime(start, getTickCount()) / 1000;
+
+	cout << endl << captured << " frames captured in " << seconds << "s, " << displayed << " displayed (" << displayed / seconds << " fps), "
+		<< droppedAtCapture << " dropped at capture, " << droppedAtDisplay << " dropped at display." << endl;
+	cout << slot.detections << " detections, " << slot.skipped << " frames skipped by detection." << endl;
+
+	sort(latencies.begin(), latencies.end());
+	sort(resultAges.begin(), resultAges.end());
+
+	streamsize precision = cout.precision();
+	cout << fixed << setprecision(2);
+
+	if (!latencies.empty())
+	{
+		cout << "Capture to display (ms): p50 " << getPercentile(latencies, 0.5) << ", p95 " << getPercentile(latencies, 0.95)
+			<< ", max " << latencies.back() << endl;
+	}
+
+	if (!resultAges.empty())
+	{
+		cout << "Age of the detection drawn (ms): p50 " << getPercentile(resultAges, 0.5) << ", p95 " << getPercentile(resultAges, 0.95)
+			<< ", max " << resultAges.back() << endl;
+	}
+
+	cout.unsetf(ios::floatfield);
+	cout.precision(precision);
+}
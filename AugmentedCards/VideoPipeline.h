@@ -0,0 +1,39 @@
+#pragma once
+
+#include "OpenCV.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <functional>
+
+#include "Card.h"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Asynchronous video processing: capture, detection (on the newest frame) and display run on their own threads,
+ * so a slow detection never freezes the preview nor stalls the camera.
+ */
+
+const int PIPELINE_RING_SIZE = 4;
+
+/* What happens to frames when display cannot keep up with capture. */
+enum FrameDropPolicy
+{
+	// Display skips to the newest captured frame, stale frames are dropped
+	DropOldest,
+	// Capture drops the new frame while the ring buffer is full
+	DropNewest,
+	// Capture waits for room in the ring buffer, no frame is lost (e.g. processing a video file)
+	Block
+};
+
+/* Parses the name of a frame drop policy (oldest, newest, block). Returns false if it is not a valid one. */
+bool parseFrameDropPolicy(const string &name, FrameDropPolicy &policy);
+
+/* Runs the pipeline until the video ends (or ESC is pressed, when displaying), reading a file at sourceFps (0 for as fast as possible).
+ * Reports the frames captured, dropped and displayed, and the capture-to-display latency at the end. */
+void runVideoPipeline(VideoCapture &cap, const function<vector<Card>(const Mat &)> &detect,
+	const function<void(Mat &, const vector<Card> &)> &draw, FrameDropPolicy policy, double sourceFps, bool display);
@@ -0,0 +1,35 @@
+#include "Workspace.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+static atomic<int64_t> workspaceAllocations(0);
+
+Mat Workspace::getBuffer(const char *name, Size size, int type, int index)
+{
+	Mat &buffer = buffers[make_pair(name, index)];
+
+	// Grown to fit both the current and the new size, so alternating sizes (e.g. cards moving in a frame) settle after a few frames
+	if (buffer.type() != type || buffer.cols < size.width || buffer.rows < size.height)
+	{
+		int cols = buffer.type() == type ? max(buffer.cols, size.width) : size.width;
+		int rows = buffer.type() == type ? max(buffer.rows, size.height) : size.height;
+
+		buffer.create(rows, cols, type);
+		workspaceAllocations++;
+		PROFILE_COUNT("workspace allocations", 1);
+	}
+
+	return buffer(Rect(0, 0, size.width, size.height));
+}
+
+Workspace &getWorkspace()
+{
+	static thread_local Workspace workspace;
+	return workspace;
+}
+
+int64_t getWorkspaceAllocations()
+{
+	return workspaceAllocations.load();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "OpenCV.h"
+
+#include <map>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Per-thread pool of image buffers reused by the detection pipeline, identified by a (literal) name and an index.
+ * Buffers only grow, so once they are warmed up frames no longer allocate them.
+ */
+class Workspace
+{
+private:
+	map<pair<const char *, int>, Mat> buffers;
+
+public:
+	/* Returns an image of the given size and type, backed by one of the buffers. Its content is undefined.
+	 * The image is overwritten by the next request for the same buffer, so it should not outlive the function using it. */
+	Mat getBuffer(const char *name, Size size, int type, int index = 0);
+};
+
+/* Returns the workspace of the calling thread. */
+Workspace &getWorkspace();
+
+/* Returns the number of buffer allocations, across every workspace. Stays the same once the pipeline has warmed up. */
+int64_t getWorkspaceAllocations();
@@ -0,0 +1,598 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+#include <algorithm>
+
+#include "CardDetection.h"
+#include "CardDetector.h"
+#include "DeckCache.h"
+#include "SimpleGame.h"
+#include "ThreadPool.h"
+#include "Workspace.h"
+
+using namespace std;
+
+/*
+ * Benchmarks of each stage of the detection pipeline, and end-to-end runs over the Assets images checked against labels.txt.
+ * Usage: AugmentedCardsBenchmark [--assets ../Assets/] [--filter text] [--min-time seconds] [--threads N]
+ */
+
+const int BENCH_MIN_ITERATIONS = 5;
+const int BENCH_IMAGES = 10;
+
+/* Command line options. */
+struct BenchOptions
+{
+	string assets;
+	string filter;
+	double minTime;
+	int threads;
+};
+
+/* Labelled image: filename and the cards in it (in no particular order). */
+struct LabelledImage
+{
+	string filename;
+	vector<string> cards;
+};
+
+static BenchOptions benchOptions;
+
+static double getElapsedTime(int64 start)
+{
+	return (getTickCount() - start) * 1000.0 / getTickFrequency();
+}
+
+static bool fileExists(const string &filename)
+{
+	return ifstream(filename).good();
+}
+
+/* Times a function until it ran for the minimum time (and iterations), then prints the mean, median and fastest run.
+ * Returns the mean in milliseconds, or -1 if the benchmark is filtered out. */
+static double runBenchmark(const string &name, const function<void()> &body)
+{
+	if (name.find(benchOptions.filter) == string::npos)
+	{
+		return -1;
+	}
+
+	vector<double> samples;
+	double total = 0;
+
+	// Warm up (caches, lazy allocations, thread pool)
+	body();
+
+	while ((int)samples.size() < BENCH_MIN_ITERATIONS || total < benchOptions.minTime * 1000)
+	{
+		int64 start = getTickCount();
+		body();
+
+		samples.push_back(getElapsedTime(start));
+		total += samples.back();
+	}
+
+	sort(samples.begin(), samples.end());
+
+	cout << left << setw(44) << name << right << setw(8) << samples.size() << fixed << setprecision(3)
+		<< setw(12) << total / samples.size() << setw(12) << samples[samples.size() / 2] << setw(12) << samples[0] << endl;
+
+	return total / samples.size();
+}
+
+static void printHeader(const string &title)
+{
+	cout << endl << left << setw(44) << title << right << setw(8) << "runs" << setw(12) << "mean (ms)" << setw(12) << "median" << setw(12) << "min" << endl;
+}
+
+static Mat readAssetImage(const string &filename)
+{
+	Mat image = imread(benchOptions.assets + filename, IMREAD_COLOR);
+
+	if (image.empty())
+	{
+		cout << "Could not open or find the image: " << benchOptions.assets + filename << endl;
+		exit(-1);
+	}
+
+	// Same limits as the interactive mode, so contours and timings match
+	return resizeWithLimits(image, 1000, 700);
+}
+
+static vector<LabelledImage> readLabels(const string &filename)
+{
+	ifstream file(filename);
+	string line, symbol, suit;
+	vector<LabelledImage> labels;
+
+	// Each line holds an image, followed by pairs of symbols/suits
+	while (getline(file, line))
+	{
+		stringstream stream(line);
+		LabelledImage image;
+
+		if (!(stream >> image.filename))
+		{
+			continue;
+		}
+
+		while (stream >> symbol >> suit)
+		{
+			image.cards.push_back(symbol + " " + suit);
+		}
+
+		labels.push_back(image);
+	}
+
+	return labels;
+}
+
+/* Returns the number of cards in a move that are found in the labels, each label being used once. */
+static int countCorrectCards(const vector<Card> &move, vector<string> labels)
+{
+	int correct = 0;
+
+	for (size_t i = 0; i < move.size(); i++)
+	{
+		vector<string>::iterator it = find(labels.begin(), labels.end(), move[i].symbol + " " + move[i].suit);
+
+		if (it != labels.end())
+		{
+			labels.erase(it);
+			correct++;
+		}
+	}
+
+	return correct;
+}
+
+static string getMethodName(DetectionMethod method)
+{
+	if (method == Surf)
+	{
+		return "surf";
+	}
+
+	else if (method == Orb)
+	{
+		return "orb";
+	}
+
+	return method == Corner ? "corner" : "binary";
+}
+
+static bool hasDeck(DetectionMethod method)
+{
+	string path = benchOptions.assets + "deck/";
+	return fileExists(path + getDeckImageName(method)) || fileExists(path + getDeckCacheName(method));
+}
+
+static vector<Card> detectMove(const Mat &image, const vector<Card> &deck, const DeckIndex &index, DetectionMethod method, bool allCards)
+{
+	if (allCards)
+	{
+		vector<Card> cards = findCardCandidates(image);
+		identifyCards(image, cards, deck, index, method);
+		return cards;
+	}
+
+	vector<vector<Point>> contours = getContours(image);
+	vector<Card> cards = locateCards(image, contours, GAME_CARDS);
+
+	if ((int)cards.size() < GAME_CARDS)
+	{
+		return vector<Card>();
+	}
+
+	identifyCards(image, cards, deck, index, method);
+	return cards;
+}
+
+static void runStageBenchmarks()
+{
+	printHeader("Stages (1.jpg, largest card)");
+
+	Mat image = readAssetImage("1.jpg");
+	Mat other = readAssetImage("2.jpg");
+	vector<vector<Point>> contours = getContours(image);
+	vector<vector<Point>> otherContours = getContours(other);
+
+	if (contours.empty() || otherContours.empty())
+	{
+		cout << "No contours found in the benchmark images." << endl;
+		return;
+	}
+
+	const vector<Point> &contour = contours[0];
+	Rectangle rectangle = getCardRectangleByEquation(contour);
+
+	runBenchmark("getContours", [&]() { getContours(image); });
+	runBenchmark("getContours/top4", [&]() { getContours(image, GAME_CARDS); });
+	runBenchmark("getContours/external", [&]() { getContours(image, GAME_CARDS, true); });
+	runBenchmark("findCardCandidates", [&]() { findCardCandidates(image); });
+	runBenchmark("getCardRectangle", [&]() { getCardRectangle(contour); });
+	runBenchmark("getCardRectangleByDiagonals", [&]() { getCardRectangleByDiagonals(contour); });
+	runBenchmark("getCardRectangleByEquation", [&]() { getCardRectangleByEquation(contour); });
+	runBenchmark("isPlausibleCard", [&]() { isPlausibleCard(image, contour, rectangle); });
+	runBenchmark("getCardPerspective/binary", [&]() { getCardPerspective(image, rectangle, Binary); });
+	runBenchmark("getCardPerspective/surf", [&]() { getCardPerspective(image, rectangle, Surf); });
+
+	// Two perspectives of different cards, as the binary method compares a card against the deck
+	Mat binary1 = getCardPerspective(image, rectangle, Binary);
+	Mat binary2 = getCardPerspective(other, getCardRectangleByEquation(otherContours[0]), Binary);
+
+	runBenchmark("getBinaryDiff", [&]() { getBinaryDiff(binary1, binary2); });
+
+	// The corner method reads its signatures from the same binary perspectives
+	CornerSignature signature1 = getCornerSignature(binary1);
+	CornerSignature signature2 = getCornerSignature(binary2);
+
+	runBenchmark("getCornerSignature", [&]() { getCornerSignature(binary1); });
+	runBenchmark("getCornerSignatureDiff", [&]() { getCornerSignatureDiff(signature1, signature2); });
+
+	// Features are computed once, only matching is timed
+	vector<KeyPoint> keyPoints1, keyPoints2;
+	Mat descriptors1, descriptors2;
+	Mat surf1 = getCardPerspective(image, rectangle, Surf);
+	Mat surf2 = getCardPerspective(other, getCardRectangleByEquation(otherContours[0]), Surf);
+
+	runBenchmark("computeFeatures/orb", [&]() { computeFeatures(surf1, Orb, keyPoints1, descriptors1); });
+
+#ifdef HAVE_SURF
+	runBenchmark("computeFeatures/surf", [&]() { computeFeatures(surf1, Surf, keyPoints1, descriptors1); });
+
+	computeFeatures(surf1, Surf, keyPoints1, descriptors1);
+	computeFeatures(surf2, Surf, keyPoints2, descriptors2);
+
+	if (!descriptors1.empty() && !descriptors2.empty())
+	{
+		runBenchmark("getSurfMatches", [&]() { getSurfMatches(keyPoints1, descriptors1, keyPoints2, descriptors2); });
+	}
+#endif
+
+	// Drawing a full move, on a fresh copy each time
+	vector<Card> move;
+
+	for (size_t i = 0; i < contours.size() && (int)i < GAME_CARDS; i++)
+	{
+		Card card;
+		card.isNumber = false;
+		card.symbol = "K";
+		card.suit = "CLUBS";
+		card.contours = contours[i];
+		card.rectangle = getCardRectangleByEquation(contours[i]);
+		move.push_back(card);
+	}
+
+	vector<int> winners(1, 0);
+	Mat canvas;
+
+	runBenchmark("drawCards", [&]()
+	{
+		image.copyTo(canvas);
+		drawCards(canvas, move, winners);
+	});
+}
+
+// Pixel by pixel versions of copyTransparent and appendToMat, as a baseline for the row kernels
+static void copyTransparentAt(Mat &image1, const Mat &image2)
+{
+	for (int i = 0; i < image2.rows; i++)
+	{
+		for (int j = 0; j < image2.cols; j++)
+		{
+			Vec3b pixel = image2.at<Vec3b>(i, j);
+
+			if (pixel[0] != 0 || pixel[1] != 0 || pixel[2] != 0)
+			{
+				image1.at<Vec3b>(i, j) = pixel;
+			}
+		}
+	}
+}
+
+static void appendToMatAt(Mat &image, const Mat &section, int x, int y)
+{
+	for (int i = 0; i < section.rows; i++)
+	{
+		for (int j = 0; j < section.cols; j++)
+		{
+			image.at<Vec3b>(i + y, j + x) = section.at<Vec3b>(i, j);
+		}
+	}
+}
+
+static void runKernelBenchmarks()
+{
+	const string names[] = { "720p", "1080p", "4K" };
+	const Size sizes[] = { Size(1280, 720), Size(1920, 1080), Size(3840, 2160) };
+
+	printHeader("Kernels");
+
+	for (int i = 0; i < 3; i++)
+	{
+		Mat frame = Mat(sizes[i], CV_8UC3, Scalar(40, 90, 160));
+		Mat overlay = Mat::zeros(sizes[i], CV_8UC3);
+		Mat canvas = Mat::zeros(sizes[i].height, sizes[i].width * 2, CV_8UC3);
+
+		// A card sized overlay with text, as drawn by drawCardValue
+		Rect card(sizes[i].width / 4, sizes[i].height / 4, sizes[i].width / 4, sizes[i].height / 3);
+		drawTextCentered(overlay, Point(card.x + card.width / 2, card.y + card.height / 2), "10 HEARTS", Scalar(0, 255, 0));
+
+		runBenchmark("copyTransparent/at/" + names[i], [&]() { copyTransparentAt(frame, overlay); });
+		runBenchmark("copyTransparent/rows/" + names[i], [&]() { copyTransparent(frame, overlay); });
+
+		runBenchmark("copyTransparent/rows+roi/" + names[i], [&]()
+		{
+			Mat section = frame(card);
+			copyTransparent(section, overlay(card));
+		});
+
+		// Overlay of a single card, as in every frame of the video modes
+		Card value;
+		value.isNumber = true;
+		value.symbol = "10";
+		value.suit = "HEARTS";
+		value.rectangle = Rectangle{ Point(card.x, card.br().y), card.tl(), Point(card.br().x, card.y), card.br() };
+
+		runBenchmark("drawCardValue/" + names[i], [&]() { drawCardValue(frame, value, true); });
+
+		runBenchmark("appendToMat/at/" + names[i], [&]() { appendToMatAt(canvas, frame, sizes[i].width, 0); });
+		runBenchmark("appendToMat/rows/" + names[i], [&]() { appendToMat(canvas, frame, sizes[i].width, 0); });
+	}
+}
+
+static void runEndToEndBenchmarks(DetectionMethod method, const vector<LabelledImage> &labels)
+{
+	string methodName = getMethodName(method);
+
+	if (!hasDeck(method))
+	{
+		cout << endl << "Skipping the " << methodName << " method, its deck was not found." << endl;
+		return;
+	}
+
+	vector<Card> deck = readDeckList(benchOptions.assets + "deck/");
+	readDeckImage(benchOptions.assets + "deck/", deck, method);
+	DeckIndex index = buildDeckIndex(deck, method);
+
+	printHeader("End to end (" + methodName + ")");
+
+	for (int i = 1; i <= BENCH_IMAGES; i++)
+	{
+		string filename = to_string(i) + ".jpg";
+		Mat image = readAssetImage(filename);
+		Mat canvas;
+
+		runBenchmark("detect/" + methodName + "/" + filename, [&]()
+		{
+			image.copyTo(canvas);
+
+			SimpleGame game;
+			vector<Card> move = detectMove(canvas, deck, index, method, false);
+			drawCards(canvas, move, game.evaluateGame(move));
+		});
+	}
+
+	// Every image has been detected a few times by now, so buffers of the steady state should not be allocated anymore
+	int64_t allocations = getWorkspaceAllocations();
+
+	for (int i = 1; i <= BENCH_IMAGES; i++)
+	{
+		Mat image = readAssetImage(to_string(i) + ".jpg");
+		SimpleGame game;
+		vector<Card> move = detectMove(image, deck, index, method, false);
+		drawCards(image, move, game.evaluateGame(move));
+	}
+
+	cout << endl << "Workspace allocations after warm-up (" << methodName << "): " << getWorkspaceAllocations() - allocations << endl;
+
+	// Matching cost by number of cards, one card at a time (in parallel) against a single batch. The cards of 1.jpg are repeated
+	Mat table = readAssetImage("1.jpg");
+	vector<Card> candidates = findCardCandidates(table);
+	vector<Mat> perspectives;
+
+	for (int count = 1; count <= 16 && !candidates.empty(); count *= 2)
+	{
+		while ((int)perspectives.size() < count)
+		{
+			perspectives.push_back(getCardPerspective(table, candidates[perspectives.size() % candidates.size()].rectangle, method));
+		}
+
+		runBenchmark("match/" + methodName + "/per-card/" + to_string(count), [&]()
+		{
+			parallelFor(count, [&](int i) { matchCards(vector<Mat>(1, perspectives[i]), deck, index, method); });
+		});
+
+		runBenchmark("match/" + methodName + "/batch/" + to_string(count), [&]() { matchCards(perspectives, deck, index, method); });
+		runBenchmark("rank/" + methodName + "/batch/" + to_string(count), [&]() { rankCards(perspectives, deck, index, method); });
+	}
+
+	// Identification of a still frame, matching every card each time, or only once every TTL detections through the recognition cache
+	if (!candidates.empty())
+	{
+		vector<Card> cards = candidates;
+		RecognitionCache cache;
+
+		runBenchmark("identify/" + methodName + "/uncached", [&]() { identifyCards(table, cards, deck, index, method); });
+		runBenchmark("identify/" + methodName + "/cached", [&]() { identifyCards(table, cards, deck, index, method, cache); });
+
+		if (cache.getHits() + cache.getMisses() > 0)
+		{
+			cout << "  recognition cache: " << cache.getHits() << " hits, " << cache.getMisses() << " misses" << endl;
+		}
+	}
+
+	// Throughput of the detection engine by number of frames per call, every card of all frames being matched as a single batch
+	CardDetector detector(benchOptions.assets + "deck/", method);
+	vector<Mat> frames;
+
+	if (!detector.isValid())
+	{
+		cout << "Could not load the deck: " << benchOptions.assets + "deck/" << endl;
+		exit(-1);
+	}
+
+	int frameCards = 0;
+
+	for (int count = 1; count <= 16; count *= 2)
+	{
+		while ((int)frames.size() < count)
+		{
+			frames.push_back(readAssetImage(to_string(frames.size() % BENCH_IMAGES + 1) + ".jpg"));
+			frameCards += findCardCandidates(frames.back()).size();
+		}
+
+		double mean = runBenchmark("detector/" + methodName + "/frames/" + to_string(count), [&]() { detector.detect(frames); });
+
+		if (mean > 0)
+		{
+			cout << "  " << frameCards << " cards, " << setprecision(1) << frameCards * 1000.0 / mean << " cards/s" << endl;
+		}
+	}
+
+	// Recognition rate, run once per image, for the largest cards and for every card found
+	for (int allCards = 0; allCards <= 1; allCards++)
+	{
+		int correctCards = 0, totalCards = 0, correctImages = 0;
+
+		for (size_t i = 0; i < labels.size(); i++)
+		{
+			Mat image = readAssetImage(labels[i].filename);
+			vector<Card> move = detectMove(image, deck, index, method, allCards != 0);
+			int correct = countCorrectCards(move, labels[i].cards);
+
+			correctCards += correct;
+			totalCards += labels[i].cards.size();
+			correctImages += correct == (int)labels[i].cards.size() && move.size() == labels[i].cards.size() ? 1 : 0;
+		}
+
+		if (totalCards > 0)
+		{
+			cout << endl << "Accuracy (" << methodName << (allCards ? ", all cards" : "") << "): " << correctCards << "/" << totalCards << " cards ("
+				<< setprecision(1) << 100.0 * correctCards / totalCards << "%), " << correctImages << "/" << labels.size() << " images" << endl;
+		}
+	}
+}
+
+static void runCascadeBenchmarks(const vector<LabelledImage> &labels)
+{
+	string fallbackName = getMethodName(CASCADE_FALLBACK);
+
+	if (!hasDeck(Binary) || !hasDeck(CASCADE_FALLBACK))
+	{
+		cout << endl << "Skipping the cascade, the binary or " << fallbackName << " deck was not found." << endl;
+		return;
+	}
+
+	vector<Card> deck = readDeckList(benchOptions.assets + "deck/");
+	readDeckImage(benchOptions.assets + "deck/", deck, Binary);
+	DeckIndex index = buildDeckIndex(deck, Binary);
+
+	vector<Card> fallbackDeck = readDeckList(benchOptions.assets + "deck/");
+	readDeckImage(benchOptions.assets + "deck/", fallbackDeck, CASCADE_FALLBACK);
+	DeckIndex fallbackIndex = buildDeckIndex(fallbackDeck, CASCADE_FALLBACK);
+
+	printHeader("Cascade (binary, then " + fallbackName + ")");
+
+	for (int i = 1; i <= BENCH_IMAGES; i++)
+	{
+		string filename = to_string(i) + ".jpg";
+		Mat image = readAssetImage(filename);
+
+		runBenchmark("cascade/" + filename, [&]()
+		{
+			vector<vector<Point>> contours = getContours(image);
+			vector<Card> cards = locateCards(image, contours, GAME_CARDS);
+			identifyCardsCascade(image, cards, deck, index, Binary, fallbackDeck, fallbackIndex, CASCADE_FALLBACK);
+		});
+	}
+
+	// Recognition rate and share of cards settled by the slow method, run once per image
+	int correctCards = 0, totalCards = 0, escalations = 0, matchedCards = 0;
+
+	for (size_t i = 0; i < labels.size(); i++)
+	{
+		Mat image = readAssetImage(labels[i].filename);
+		vector<vector<Point>> contours = getContours(image);
+		vector<Card> cards = locateCards(image, contours, GAME_CARDS);
+
+		if ((int)cards.size() < GAME_CARDS)
+		{
+			cards.clear();
+		}
+
+		vector<CardMatch> matches = identifyCardsCascade(image, cards, deck, index, Binary, fallbackDeck, fallbackIndex, CASCADE_FALLBACK);
+
+		for (size_t j = 0; j < matches.size(); j++)
+		{
+			escalations += matches[j].method == CASCADE_FALLBACK ? 1 : 0;
+		}
+
+		correctCards += countCorrectCards(cards, labels[i].cards);
+		totalCards += labels[i].cards.size();
+		matchedCards += matches.size();
+	}
+
+	if (totalCards > 0)
+	{
+		cout << endl << "Accuracy (cascade): " << correctCards << "/" << totalCards << " cards (" << setprecision(1) << 100.0 * correctCards / totalCards
+			<< "%), " << escalations << "/" << matchedCards << " cards escalated to " << fallbackName << endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	benchOptions.assets = "../Assets/";
+	benchOptions.minTime = 0.5;
+	benchOptions.threads = (int)thread::hardware_concurrency();
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--assets" && i + 1 < argc)
+		{
+			benchOptions.assets = argv[++i];
+		}
+		else if (arg == "--filter" && i + 1 < argc)
+		{
+			benchOptions.filter = argv[++i];
+		}
+		else if (arg == "--min-time" && i + 1 < argc)
+		{
+			benchOptions.minTime = atof(argv[++i]);
+		}
+		else if (arg == "--threads" && i + 1 < argc)
+		{
+			benchOptions.threads = max(atoi(argv[++i]), 1);
+		}
+		else
+		{
+			cout << "Ignoring unknown option: " << arg << endl;
+		}
+	}
+
+	setThreadCount(benchOptions.threads);
+
+	vector<LabelledImage> labels = readLabels(benchOptions.assets + "labels.txt");
+
+	if (labels.empty())
+	{
+		cout << "Could not open or find the labels, accuracy will not be reported." << endl;
+	}
+
+	runStageBenchmarks();
+	runKernelBenchmarks();
+	runEndToEndBenchmarks(Binary, labels);
+#ifdef HAVE_SURF
+	runEndToEndBenchmarks(Surf, labels);
+#endif
+	runEndToEndBenchmarks(Corner, labels);
+	runEndToEndBenchmarks(Orb, labels);
+	runCascadeBenchmarks(labels);
+
+	return 0;
+}
@@ -0,0 +1,401 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <climits>
+
+#include "BitPlane.h"
+#include "CardDetection.h"
+#include "SimpleGame.h"
+#include "ThreadPool.h"
+#include "Workspace.h"
+
+using namespace std;
+
+/*
+ * Regression tests, run by ctest on a single thread: bit-packed kernels, binary matching against labels.txt and allocations.
+ * Usage: AugmentedCardsTests [--assets ../Assets/]. The exit code is 0 only when every check passes.
+ */
+
+const unsigned int TEST_SEED = 1234;
+const int TEST_MAX_WORDS = 67;
+const int TEST_MAX_OFFSET = 4;
+const int TEST_MAX_TOLERANCE = 2;
+const int TEST_FRAMES = 5;
+
+// Heap allocations left in a warmed up frame of 1.jpg: the returned cards and contours, and the storage of findContours itself
+const int64_t TEST_MAX_FRAME_ALLOCATIONS = 500;
+
+// Cards of the Assets images whose best match under getBitPlaneDiff is not the one of getBinaryDiff (see testBinaryDiff)
+const int TEST_MAX_DIFF_CHANGES = 4;
+
+// The binary method finds 30 of the 40 cards of the Assets images, one card of margin is left for other OpenCV versions
+const int TEST_MIN_CORRECT_CARDS = 29;
+
+static string testAssets = "../Assets/";
+static int failures = 0;
+
+// Every heap allocation of the program goes through here, OpenCV matrices aside (see getWorkspaceAllocations for those)
+static atomic<int64_t> heapAllocations(0);
+
+void *operator new(size_t size)
+{
+	void *memory = malloc(size > 0 ? size : 1);
+
+	if (memory == NULL)
+	{
+		throw bad_alloc();
+	}
+
+	heapAllocations++;
+	return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+	free(memory);
+}
+
+static void check(bool condition, const string &name)
+{
+	if (!condition)
+	{
+		cout << "FAILED: " << name << endl;
+		failures++;
+	}
+}
+
+/* Bit by bit popcount, the reference for popcount and popcountXor. */
+static int getReferencePopcount(const uint64_t *words, size_t count)
+{
+	int total = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		for (int bit = 0; bit < 64; bit++)
+		{
+			total += (int)((words[i] >> bit) & 1);
+		}
+	}
+
+	return total;
+}
+
+/* Pixel by pixel version of getBitPlaneDiff: differences that do not fill a (2 * tolerance + 1) square are eroded away,
+ * pixels outside the image counting as equal. */
+static int getReferenceDiff(const Mat &binary1, const Mat &binary2, int tolerance)
+{
+	Mat diff;
+	compare(binary1, binary2, diff, CMP_NE);
+
+	if (tolerance > 0)
+	{
+		Mat kernel = getStructuringElement(MORPH_RECT, Size(2 * tolerance + 1, 2 * tolerance + 1));
+		erode(diff, diff, kernel, Point(-1, -1), 1, BORDER_CONSTANT, Scalar(0));
+	}
+
+	return countNonZero(diff);
+}
+
+/* Returns a binary image (0 or 255) of scattered noise and solid blocks, so differences survive any tolerance. */
+static Mat getRandomBinary(int rows, int cols, RNG &rng)
+{
+	Mat binary(rows, cols, CV_8UC1);
+
+	rng.fill(binary, RNG::UNIFORM, 0, 256);
+	threshold(binary, binary, 200, 255, THRESH_BINARY);
+
+	for (int i = 0; i < 8; i++)
+	{
+		Point corner(rng.uniform(0, cols), rng.uniform(0, rows));
+		Size size(rng.uniform(1, cols / 4 + 2), rng.uniform(1, rows / 4 + 2));
+
+		rectangle(binary, Rect(corner, size), Scalar(rng.uniform(0, 2) * 255), -1);
+	}
+
+	return binary;
+}
+
+/* Reads labels.txt: each line holds an image, followed by pairs of symbols/suits. */
+static vector<pair<string, vector<string>>> readLabels()
+{
+	ifstream file(testAssets + "labels.txt");
+	vector<pair<string, vector<string>>> labels;
+	string line, filename, symbol, suit;
+
+	check(file.good(), "labels.txt found");
+
+	while (getline(file, line))
+	{
+		stringstream stream(line);
+		vector<string> cards;
+
+		if (!(stream >> filename))
+		{
+			continue;
+		}
+
+		while (stream >> symbol >> suit)
+		{
+			cards.push_back(symbol + " " + suit);
+		}
+
+		labels.push_back(make_pair(filename, cards));
+	}
+
+	return labels;
+}
+
+/* Reads an image of the Assets, resized with the same limits as the application so the contours are the same. */
+static Mat readTestImage(const string &filename)
+{
+	Mat image = imread(testAssets + filename, IMREAD_COLOR);
+	check(!image.empty(), "image " + filename + " found");
+
+	return image.empty() ? image : resizeWithLimits(image, 1000, 700);
+}
+
+/* Detects the cards of a game in an image, as the application does. */
+static vector<Card> detectGame(const Mat &image, const vector<Card> &deck, const DeckIndex &index)
+{
+	vector<vector<Point>> contours = getContours(image);
+	vector<Card> cards = locateCards(image, contours, GAME_CARDS);
+
+	identifyCards(image, cards, deck, index, Binary);
+	return cards;
+}
+
+static void testPopcount()
+{
+	mt19937_64 random(TEST_SEED);
+	vector<uint64_t> words1(TEST_MAX_WORDS + TEST_MAX_OFFSET), words2(words1.size()), xored(words1.size());
+
+	// Random words, then saturated ones (every byte lane at its maximum), then sparse ones
+	for (int pattern = 0; pattern < 3; pattern++)
+	{
+		for (size_t i = 0; i < words1.size(); i++)
+		{
+			words1[i] = pattern == 1 ? ~0ULL : pattern == 2 ? 1ULL << (i % 64) : random();
+			words2[i] = pattern == 1 ? 0 : random();
+			xored[i] = words1[i] ^ words2[i];
+		}
+
+		// Every length around the vector width, starting at unaligned offsets, so the SIMD loops and their scalar tails both run
+		for (int offset = 0; offset < TEST_MAX_OFFSET; offset++)
+		{
+			for (int count = 0; count <= TEST_MAX_WORDS; count++)
+			{
+				string name = "pattern " + to_string(pattern) + ", offset " + to_string(offset) + ", " + to_string(count) + " words";
+
+				check(popcount(&words1[offset], count) == getReferencePopcount(&words1[offset], count), "popcount, " + name);
+				check(popcountXor(&words1[offset], &words2[offset], count) == getReferencePopcount(&xored[offset], count), "popcountXor, " + name);
+			}
+		}
+	}
+
+	// A full resolution card, the size the accumulators have to hold
+	int fullSize = BIT_PYRAMID_SIZES[BIT_PYRAMID_LEVELS - 1];
+	vector<uint64_t> ones((size_t)fullSize * ((fullSize + 63) / 64), ~0ULL), zeros(ones.size(), 0);
+
+	check(popcount(ones.data(), ones.size()) == 64 * (int)ones.size(), "popcount, full resolution");
+	check(popcountXor(ones.data(), zeros.data(), ones.size()) == 64 * (int)ones.size(), "popcountXor, full resolution");
+}
+
+static void testBitPlanes()
+{
+	RNG rng(TEST_SEED);
+	const Size sizes[] = { Size(56, 56), Size(112, 112), Size(450, 450), Size(65, 70), Size(3, 5) };
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		Mat binary1 = getRandomBinary(sizes[s].height, sizes[s].width, rng);
+		Mat binary2 = getRandomBinary(sizes[s].height, sizes[s].width, rng);
+		BitPlane plane1 = packBitPlane(binary1);
+		BitPlane plane2 = packBitPlane(binary2);
+		string name = to_string(sizes[s].width) + "x" + to_string(sizes[s].height);
+
+		check(popcount(plane1.words.get(), (size_t)plane1.rows * plane1.stride) == countNonZero(binary1), "packBitPlane, " + name);
+
+		for (int tolerance = 0; tolerance <= TEST_MAX_TOLERANCE; tolerance++)
+		{
+			int diff = getBitPlaneDiff(plane1, plane2, tolerance);
+			string diffName = "getBitPlaneDiff, " + name + ", tolerance " + to_string(tolerance);
+
+			check(diff == getReferenceDiff(binary1, binary2, tolerance), diffName);
+
+			// Under the bound the difference is exact, above it only has to exceed it
+			const int bounds[] = { 0, diff / 2, diff, diff + 1 };
+
+			for (size_t b = 0; b < sizeof(bounds) / sizeof(bounds[0]); b++)
+			{
+				int bounded = getBitPlaneDiff(plane1, plane2, tolerance, bounds[b]);
+
+				check(diff <= bounds[b] ? bounded == diff : bounded > bounds[b], diffName + ", bound " + to_string(bounds[b]));
+			}
+		}
+	}
+}
+
+/* getBitPlaneDiff must pick the same card as getBinaryDiff on the Assets, but for these changes from a wrong card to a right one:
+ * 3.jpg J CLUBS (was Q CLUBS), 4.jpg J CLUBS (was Q SPADES), 7.jpg J COLORJOKER (was J GRAYJOKER), 9.jpg K DIAMONDS (was J DIAMONDS). */
+static void testBinaryDiff(const vector<Card> &deck)
+{
+	vector<pair<string, vector<string>>> labels = readLabels();
+	int changes = 0;
+
+	for (size_t l = 0; l < labels.size(); l++)
+	{
+		const vector<string> &cardLabels = labels[l].second;
+		Mat image = readTestImage(labels[l].first);
+
+		if (image.empty())
+		{
+			continue;
+		}
+
+		vector<vector<Point>> contours = getContours(image);
+		vector<Card> cards = locateCards(image, contours, GAME_CARDS);
+
+		for (size_t i = 0; i < cards.size(); i++)
+		{
+			Mat perspective, flipped;
+			getCardPerspective(image, cards[i].rectangle, Binary, perspective);
+			flip(perspective, flipped, -1);
+
+			BitPlane plane = packBitPlane(perspective);
+			BitPlane flippedPlane = packBitPlane(flipped);
+			pair<int, int> oldBest(INT_MAX, -1), newBest(INT_MAX, -1);
+
+			for (size_t d = 0; d < deck.size(); d++)
+			{
+				const BitPlane &deckPlane = deck[d].pyramid.back();
+				int oldDiff = min(getBinaryDiff(perspective, deck[d].image), getBinaryDiff(flipped, deck[d].image));
+				int newDiff = min(getBitPlaneDiff(plane, deckPlane, BINARY_TOLERANCE), getBitPlaneDiff(flippedPlane, deckPlane, BINARY_TOLERANCE));
+
+				oldBest = min(oldBest, make_pair(oldDiff, (int)d));
+				newBest = min(newBest, make_pair(newDiff, (int)d));
+			}
+
+			if (oldBest.second == newBest.second)
+			{
+				continue;
+			}
+
+			string oldCard = deck[oldBest.second].symbol + " " + deck[oldBest.second].suit;
+			string newCard = deck[newBest.second].symbol + " " + deck[newBest.second].suit;
+			bool oldRight = find(cardLabels.begin(), cardLabels.end(), oldCard) != cardLabels.end();
+			bool newRight = find(cardLabels.begin(), cardLabels.end(), newCard) != cardLabels.end();
+
+			// A change is only accepted when it fixes a card
+			cout << "Binary difference change: " << labels[l].first << " " << newCard << " (was " << oldCard << ")" << endl;
+			check(newRight && !oldRight, "binary difference change in " + labels[l].first + " to a right card");
+			changes++;
+		}
+	}
+
+	check(changes <= TEST_MAX_DIFF_CHANGES, "at most " + to_string(TEST_MAX_DIFF_CHANGES) + " binary difference changes (" + to_string(changes) + ")");
+}
+
+static void testAccuracy(const vector<Card> &deck, const DeckIndex &index)
+{
+	vector<pair<string, vector<string>>> labels = readLabels();
+	int correctCards = 0, totalCards = 0;
+
+	// Each label is used once, whatever the order of the cards
+	for (size_t l = 0; l < labels.size(); l++)
+	{
+		vector<string> &cardLabels = labels[l].second;
+		Mat image = readTestImage(labels[l].first);
+
+		totalCards += (int)cardLabels.size();
+
+		if (image.empty())
+		{
+			continue;
+		}
+
+		vector<Card> cards = detectGame(image, deck, index);
+
+		for (size_t i = 0; i < cards.size(); i++)
+		{
+			vector<string>::iterator it = find(cardLabels.begin(), cardLabels.end(), cards[i].symbol + " " + cards[i].suit);
+
+			if (it != cardLabels.end())
+			{
+				cardLabels.erase(it);
+				correctCards++;
+			}
+		}
+	}
+
+	cout << "Accuracy (binary): " << correctCards << "/" << totalCards << " cards" << endl;
+	check(correctCards >= TEST_MIN_CORRECT_CARDS, "binary method finds at least " + to_string(TEST_MIN_CORRECT_CARDS) + " cards");
+}
+
+static void testAllocations(const vector<Card> &deck, const DeckIndex &index)
+{
+	Mat image = readTestImage("1.jpg");
+
+	if (image.empty())
+	{
+		return;
+	}
+
+	// A single detection warms up the workspace, the following frames of the same image should reuse all of its buffers
+	detectGame(image, deck, index);
+
+	int64_t workspaceAllocations = getWorkspaceAllocations();
+	int64_t maxAllocations = 0;
+
+	for (int frame = 0; frame < TEST_FRAMES; frame++)
+	{
+		int64_t start = heapAllocations.load();
+		detectGame(image, deck, index);
+		int64_t allocations = heapAllocations.load() - start;
+
+		maxAllocations = max(maxAllocations, allocations);
+		check(allocations <= TEST_MAX_FRAME_ALLOCATIONS, "heap allocations of frame " + to_string(frame + 1) + " (" + to_string(allocations)
+			+ ", at most " + to_string(TEST_MAX_FRAME_ALLOCATIONS) + ")");
+	}
+
+	cout << "Heap allocations per frame: " << maxAllocations << endl;
+	check(getWorkspaceAllocations() == workspaceAllocations, "no workspace allocation after warm-up ("
+		+ to_string(getWorkspaceAllocations() - workspaceAllocations) + ")");
+}
+
+int main(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--assets" && i + 1 < argc)
+		{
+			testAssets = argv[++i];
+		}
+		else
+		{
+			cout << "Ignoring unknown option: " << arg << endl;
+		}
+	}
+
+	setThreadCount(1);
+
+	testPopcount();
+	testBitPlanes();
+
+	vector<Card> deck = readDeckList(testAssets + "deck/");
+	readDeckImage(testAssets + "deck/", deck, Binary);
+	DeckIndex index = buildDeckIndex(deck, Binary);
+
+	testBinaryDiff(deck);
+	testAccuracy(deck, index);
+	testAllocations(deck, index);
+
+	cout << (failures == 0 ? "All checks passed." : to_string(failures) + " checks failed.") << endl;
+	return failures == 0 ? 0 : 1;
+}